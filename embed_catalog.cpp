@@ -0,0 +1,231 @@
+// Generates embedded_catalog.hpp from a JSON food catalog so the reference
+// foods are compiled into the diet manager binary.
+//
+//   g++ -std=c++17 -O2 -o embed_catalog embed_catalog.cpp
+//   ./embed_catalog reference_foods.json embedded_catalog.hpp
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include "json.hpp"
+
+using namespace std;
+using json = nlohmann::json;
+
+struct Component
+{
+    string name;
+    float servings;
+};
+
+struct Entry
+{
+    string name;
+    vector<string> keywords;
+    bool composite = false;
+    float calories = 0.0f;
+    vector<Component> components;
+    vector<pair<string, float>> nutrients; // basic foods only, by key
+    int state = 0; // 0 = unvisited, 1 = on stack, 2 = done
+};
+
+// C++ string literal; octal escapes keep non-ASCII bytes exact
+static string literal(const string &text)
+{
+    string out = "\"";
+    for (unsigned char c : text)
+    {
+        if (c == '"' || c == '\\')
+        {
+            out += '\\';
+            out += static_cast<char>(c);
+        }
+        else if (c >= 0x20 && c < 0x7f && c != '?')
+        {
+            out += static_cast<char>(c);
+        }
+        else
+        {
+            char escape[5];
+            snprintf(escape, sizeof(escape), "\\%03o", c);
+            out += escape;
+        }
+    }
+    return out + "\"sv";
+}
+
+static string floatLiteral(float value)
+{
+    char buffer[32];
+    auto result = to_chars(buffer, buffer + sizeof(buffer), value);
+    string text(buffer, result.ptr);
+    if (text.find_first_of(".e") == string::npos)
+        text += ".0";
+    return text + "f";
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 3)
+    {
+        cerr << "Usage: " << argv[0] << " <catalog.json> <embedded_catalog.hpp>" << endl;
+        return 1;
+    }
+
+    ifstream in(argv[1]);
+    if (!in)
+    {
+        cerr << "Cannot open " << argv[1] << endl;
+        return 1;
+    }
+
+    vector<Entry> entries;
+    try
+    {
+        json catalog;
+        in >> catalog;
+        for (const auto &item : catalog)
+        {
+            Entry entry;
+            entry.name = item.at("name").get<string>();
+            entry.keywords = item.at("keywords").get<vector<string>>();
+            entry.composite = item.at("type").get<string>() == "composite";
+            if (entry.composite)
+            {
+                for (const auto &component : item.at("components"))
+                    entry.components.push_back({component.at("name").get<string>(), component.at("servings").get<float>()});
+            }
+            else
+            {
+                entry.calories = item.at("calories").get<float>();
+                if (item.contains("nutrients"))
+                {
+                    for (const auto &[key, value] : item.at("nutrients").items())
+                        entry.nutrients.emplace_back(key, value.get<float>());
+                }
+            }
+            entries.push_back(move(entry));
+        }
+    }
+    catch (const exception &e)
+    {
+        cerr << "Error reading " << argv[1] << ": " << e.what() << endl;
+        return 1;
+    }
+
+    // Binary search in the manager relies on this order
+    sort(entries.begin(), entries.end(), [](const Entry &a, const Entry &b)
+         { return a.name < b.name; });
+    map<string, uint32_t> indexOf;
+    for (size_t i = 0; i < entries.size(); ++i)
+    {
+        if (!indexOf.emplace(entries[i].name, static_cast<uint32_t>(i)).second)
+        {
+            cerr << "Duplicate food: " << entries[i].name << endl;
+            return 1;
+        }
+    }
+
+    // Precompute composite calories depth first, rejecting cycles and unknown components
+    for (size_t root = 0; root < entries.size(); ++root)
+    {
+        vector<pair<size_t, size_t>> stack{{root, 0}};
+        while (!stack.empty())
+        {
+            auto &[current, next] = stack.back();
+            Entry &entry = entries[current];
+            if (entry.state == 2 || (next == 0 && entry.state == 1))
+            {
+                if (entry.state == 1)
+                {
+                    cerr << "Cycle through composite food: " << entry.name << endl;
+                    return 1;
+                }
+                stack.pop_back();
+                continue;
+            }
+            entry.state = 1;
+            if (next < entry.components.size())
+            {
+                auto found = indexOf.find(entry.components[next].name);
+                if (found == indexOf.end())
+                {
+                    cerr << entry.name << ": unknown component " << entry.components[next].name << endl;
+                    return 1;
+                }
+                ++next;
+                if (entries[found->second].state == 1)
+                {
+                    cerr << "Cycle through composite food: " << entries[found->second].name << endl;
+                    return 1;
+                }
+                if (entries[found->second].state == 0)
+                    stack.push_back({found->second, 0});
+                continue;
+            }
+            if (entry.composite)
+            {
+                entry.calories = 0.0f;
+                for (const auto &component : entry.components)
+                    entry.calories += entries[indexOf[component.name]].calories * component.servings;
+            }
+            entry.state = 2;
+            stack.pop_back();
+        }
+    }
+
+    ostringstream foods, keywords, components, nutrients;
+    size_t keywordCount = 0, componentCount = 0, nutrientCount = 0;
+    for (const auto &entry : entries)
+    {
+        foods << "    {" << literal(entry.name) << ", " << keywordCount << ", " << entry.keywords.size() << ", "
+              << componentCount << ", " << entry.components.size() << ", " << floatLiteral(entry.calories) << ", "
+              << (entry.composite ? "true" : "false") << ", " << nutrientCount << ", " << entry.nutrients.size() << "},\n";
+        for (const auto &keyword : entry.keywords)
+            keywords << "    " << literal(keyword) << ",\n";
+        for (const auto &component : entry.components)
+            components << "    {" << indexOf[component.name] << ", " << floatLiteral(component.servings) << "},\n";
+        for (const auto &[key, value] : entry.nutrients)
+            nutrients << "    {" << literal(key) << ", " << floatLiteral(value) << "},\n";
+        keywordCount += entry.keywords.size();
+        componentCount += entry.components.size();
+        nutrientCount += entry.nutrients.size();
+    }
+
+    ofstream out(argv[2], ios::binary | ios::trunc);
+    out << "// Generated by embed_catalog from " << argv[1] << ". Do not edit.\n"
+        << "// Included by food.cpp after the EmbeddedCatalog definitions.\n\n";
+    if (!entries.empty())
+    {
+        out << "inline constexpr EmbeddedFood embeddedFoodTable[] = {\n"
+            << foods.str() << "};\n\n";
+        if (keywordCount)
+            out << "inline constexpr string_view embeddedKeywordTable[] = {\n"
+                << keywords.str() << "};\n\n";
+        if (componentCount)
+            out << "inline constexpr EmbeddedComponent embeddedComponentTable[] = {\n"
+                << components.str() << "};\n\n";
+        if (nutrientCount)
+            out << "inline constexpr EmbeddedNutrient embeddedNutrientTable[] = {\n"
+                << nutrients.str() << "};\n\n";
+    }
+    out << "constexpr EmbeddedCatalog embeddedCatalog{"
+        << (entries.empty() ? "nullptr" : "embeddedFoodTable") << ", " << entries.size() << ", "
+        << (keywordCount ? "embeddedKeywordTable" : "nullptr") << ", "
+        << (componentCount ? "embeddedComponentTable" : "nullptr") << ", "
+        << (nutrientCount ? "embeddedNutrientTable" : "nullptr") << "};\n";
+    out.close();
+    if (!out)
+    {
+        cerr << "Error writing " << argv[2] << endl;
+        return 1;
+    }
+
+    cout << "Embedded " << entries.size() << " foods into " << argv[2] << endl;
+    return 0;
+}
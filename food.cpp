@@ -9,10 +9,55 @@
 #include <sstream>
 #include <iomanip>
 #include <stack>
+#include <queue>
 #include <ctime>
 #include <iomanip>
 #include <chrono>
 #include <limits>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <cstdio>
+#include <unordered_set>
+#include <set>
+#include <string_view>
+#include <thread>
+#include <atomic>
+#include <future>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <cerrno>
+#include <charconv>
+#include <cmath>
+#include <type_traits>
+#include <array>
+#include <bitset>
+#include <random>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#if defined(__linux__) && __has_include(<linux/io_uring.h>) && __has_include(<linux/version.h>)
+#include <linux/version.h>
+// The batch writer queues renames and unlinks, which need 5.11 headers
+// (IORING_OP_RENAMEAT/UNLINKAT); older ones build without io_uring
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 11, 0)
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#define HAVE_IO_URING 1
+#endif
+#endif
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#include <immintrin.h>
+#endif
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 #include "json.hpp"
 
@@ -45,22 +90,494 @@ class Food;
 class BasicFood;
 class CompositeFood;
 
+// Writes JSON text straight into one growing buffer, without building a json
+// DOM. Keys are written in the order given, so callers emit them sorted to
+// match json::dump. A negative indent produces compact output.
+class JsonStreamWriter
+{
+private:
+    string out;
+    int indent;
+    vector<size_t> itemCounts; // one per open container
+    bool afterKey;
+
+    void newline()
+    {
+        out += '\n';
+        out.append(itemCounts.size() * static_cast<size_t>(indent), ' ');
+    }
+
+    void beforeValue()
+    {
+        if (afterKey)
+        {
+            afterKey = false;
+            return;
+        }
+        if (itemCounts.empty())
+            return;
+        if (itemCounts.back()++ > 0)
+            out += ',';
+        if (indent >= 0)
+            newline();
+    }
+
+    JsonStreamWriter &close(char bracket)
+    {
+        size_t items = itemCounts.back();
+        itemCounts.pop_back();
+        if (items > 0 && indent >= 0)
+            newline();
+        out += bracket;
+        return *this;
+    }
+
+    template <typename T>
+    JsonStreamWriter &number(T value)
+    {
+        beforeValue();
+        if constexpr (is_floating_point_v<T>)
+        {
+            if (!isfinite(value))
+            {
+                out += "null";
+                return *this;
+            }
+        }
+
+        char buffer[32];
+        auto result = to_chars(buffer, buffer + sizeof(buffer), value);
+        out.append(buffer, result.ptr);
+        if constexpr (is_floating_point_v<T>)
+        {
+            // Keep floating point values recognizable, as json::dump does ("72.0")
+            if (find_if(buffer, result.ptr, [](char c)
+                        { return c == '.' || c == 'e'; }) == result.ptr)
+                out += ".0";
+        }
+        return *this;
+    }
+
+    void writeString(string_view text)
+    {
+        static const char hex[] = "0123456789abcdef";
+        out += '"';
+        for (char c : text)
+        {
+            switch (c)
+            {
+            case '"':
+                out += "\\\"";
+                break;
+            case '\\':
+                out += "\\\\";
+                break;
+            case '\b':
+                out += "\\b";
+                break;
+            case '\f':
+                out += "\\f";
+                break;
+            case '\n':
+                out += "\\n";
+                break;
+            case '\r':
+                out += "\\r";
+                break;
+            case '\t':
+                out += "\\t";
+                break;
+            default:
+                if (static_cast<unsigned char>(c) < 0x20)
+                {
+                    out += "\\u00";
+                    out += hex[(c >> 4) & 0xf];
+                    out += hex[c & 0xf];
+                }
+                else
+                {
+                    out += c;
+                }
+            }
+        }
+        out += '"';
+    }
+
+public:
+    explicit JsonStreamWriter(int indent = 4, size_t reserveBytes = 1 << 16)
+        : indent(indent), afterKey(false)
+    {
+        out.reserve(reserveBytes);
+    }
+
+    JsonStreamWriter &beginObject()
+    {
+        beforeValue();
+        out += '{';
+        itemCounts.push_back(0);
+        return *this;
+    }
+
+    JsonStreamWriter &endObject() { return close('}'); }
+
+    JsonStreamWriter &beginArray()
+    {
+        beforeValue();
+        out += '[';
+        itemCounts.push_back(0);
+        return *this;
+    }
+
+    JsonStreamWriter &endArray() { return close(']'); }
+
+    JsonStreamWriter &key(string_view name)
+    {
+        beforeValue();
+        writeString(name);
+        out += indent >= 0 ? ": " : ":";
+        afterKey = true;
+        return *this;
+    }
+
+    JsonStreamWriter &value(string_view text)
+    {
+        beforeValue();
+        writeString(text);
+        return *this;
+    }
+
+    JsonStreamWriter &value(const string &text) { return value(string_view(text)); }
+    JsonStreamWriter &value(const char *text) { return value(string_view(text)); }
+    JsonStreamWriter &value(float number) { return this->number(number); }
+    JsonStreamWriter &value(double number) { return this->number(number); }
+    JsonStreamWriter &value(int number) { return this->number(number); }
+
+    JsonStreamWriter &value(const vector<string> &texts)
+    {
+        beginArray();
+        for (const auto &text : texts)
+            value(text);
+        return endArray();
+    }
+
+    // Ends a top-level document in a JSON Lines stream
+    JsonStreamWriter &endRecord()
+    {
+        out += '\n';
+        return *this;
+    }
+
+    // Hands over the finished document
+    string take()
+    {
+        return move(out);
+    }
+};
+
+// Nutrients a deployment can track, as tag types naming their JSON key,
+// display label and unit. A nutrient added here can be listed in
+// DIET_NUTRIENTS below.
+namespace nutrient
+{
+    struct Calories { static constexpr string_view key = "calories", label = "Calories", unit = ""; };
+    struct Protein { static constexpr string_view key = "protein", label = "Protein", unit = "g"; };
+    struct Carbohydrates { static constexpr string_view key = "carbohydrates", label = "Carbohydrates", unit = "g"; };
+    struct Fat { static constexpr string_view key = "fat", label = "Fat", unit = "g"; };
+    struct SaturatedFat { static constexpr string_view key = "saturated_fat", label = "Saturated fat", unit = "g"; };
+    struct Fiber { static constexpr string_view key = "fiber", label = "Fiber", unit = "g"; };
+    struct Sugar { static constexpr string_view key = "sugar", label = "Sugar", unit = "g"; };
+    struct Sodium { static constexpr string_view key = "sodium", label = "Sodium", unit = "mg"; };
+    struct Cholesterol { static constexpr string_view key = "cholesterol", label = "Cholesterol", unit = "mg"; };
+    struct Potassium { static constexpr string_view key = "potassium", label = "Potassium", unit = "mg"; };
+    struct Calcium { static constexpr string_view key = "calcium", label = "Calcium", unit = "mg"; };
+    struct Iron { static constexpr string_view key = "iron", label = "Iron", unit = "mg"; };
+    struct Magnesium { static constexpr string_view key = "magnesium", label = "Magnesium", unit = "mg"; };
+    struct VitaminA { static constexpr string_view key = "vitamin_a", label = "Vitamin A", unit = "mcg"; };
+    struct VitaminC { static constexpr string_view key = "vitamin_c", label = "Vitamin C", unit = "mg"; };
+    struct VitaminD { static constexpr string_view key = "vitamin_d", label = "Vitamin D", unit = "mcg"; };
+}
+
+// Compile-time list of tracked nutrients. Storage, JSON, display and the FMA
+// kernels are all generated from it.
+template <typename... Nutrients>
+struct NutrientSchema
+{
+    static constexpr size_t COUNT = sizeof...(Nutrients);
+    static constexpr array<string_view, COUNT> keys{Nutrients::key...};
+    static constexpr array<string_view, COUNT> labels{Nutrients::label...};
+    static constexpr array<string_view, COUNT> units{Nutrients::unit...};
+
+    // Position of N in the list, or COUNT
+    template <typename N>
+    static constexpr size_t index()
+    {
+        constexpr bool matches[] = {is_same_v<N, Nutrients>...};
+        for (size_t i = 0; i < COUNT; ++i)
+        {
+            if (matches[i])
+                return i;
+        }
+        return COUNT;
+    }
+
+    // Positions in key order, as JSON objects are written
+    static constexpr array<size_t, COUNT> byKey = []
+    {
+        array<size_t, COUNT> order{};
+        for (size_t i = 0; i < COUNT; ++i)
+        {
+            size_t j = i;
+            for (; j > 0 && keys[i] < keys[order[j - 1]]; --j)
+                order[j] = order[j - 1];
+            order[j] = i;
+        }
+        return order;
+    }();
+
+    // FNV-1a of the keys, so binary files can tell which schema wrote them
+    static constexpr uint32_t ID = []
+    {
+        uint32_t h = 2166136261u;
+        for (string_view key : keys)
+        {
+            for (char c : key)
+                h = (h ^ static_cast<unsigned char>(c)) * 16777619u;
+            h = (h ^ 0xFFu) * 16777619u;
+        }
+        return h;
+    }();
+};
+
+// Build with e.g. -DDIET_NUTRIENTS=Calories,Protein,Fat to track fewer
+// nutrients; Calories must come first
+#ifndef DIET_NUTRIENTS
+#define DIET_NUTRIENTS Calories, Protein, Carbohydrates, Fat, SaturatedFat, Fiber, Sugar, Sodium, \
+                       Cholesterol, Potassium, Calcium, Iron, Magnesium, VitaminA, VitaminC, VitaminD
+#endif
+
+namespace nutrient
+{
+    using Tracked = NutrientSchema<DIET_NUTRIENTS>;
+}
+
+// Members of a "nutrients" object that this build does not track, by key in
+// sorted order. Foods keep them only to write them back unchanged, so a build
+// with a shorter DIET_NUTRIENTS list does not drop them from the files.
+using UntrackedNutrients = vector<pair<string, float>>;
+
+// Nutrients of one serving as a fixed-width vector, so a total over many foods
+// adds every nutrient at once. Storage is padded to whole 8-float AVX
+// registers; the padding lanes and unset nutrients are 0.
+template <typename Schema>
+struct alignas(32) BasicNutrientVector
+{
+    static constexpr size_t COUNT = Schema::COUNT;
+    static constexpr size_t WIDTH = (COUNT + 7) / 8 * 8;
+    static constexpr size_t CALORIES = 0;
+    static constexpr size_t npos = numeric_limits<size_t>::max();
+    static_assert(Schema::template index<nutrient::Calories>() == CALORIES, "Calories must be the first nutrient");
+
+    float values[WIDTH] = {};
+
+    static constexpr string_view key(size_t index) { return Schema::keys[index]; }
+    static constexpr string_view label(size_t index) { return Schema::labels[index]; }
+    static constexpr string_view unit(size_t index) { return Schema::units[index]; }
+
+    // Index of the tracked nutrient other than calories with this key or
+    // label (case-insensitive), or npos
+    static size_t findDetail(string_view name)
+    {
+        auto same = [](string_view a, string_view b)
+        {
+            return a.size() == b.size() && equal(a.begin(), a.end(), b.begin(), [](char x, char y)
+                                                 { return tolower(static_cast<unsigned char>(x)) == tolower(static_cast<unsigned char>(y)); });
+        };
+        for (size_t i = CALORIES + 1; i < COUNT; ++i)
+        {
+            if (same(name, key(i)) || same(name, label(i)))
+                return i;
+        }
+        return npos;
+    }
+
+    float &operator[](size_t index) { return values[index]; }
+    float operator[](size_t index) const { return values[index]; }
+
+    // True if a nutrient other than calories is set
+    bool hasDetails() const
+    {
+        return any_of(values + CALORIES + 1, values + COUNT, [](float value)
+                      { return value != 0.0f; });
+    }
+
+    // The "nutrients" member of a food: every set nutrient except calories,
+    // which foods store on their own, plus the untracked ones
+    json toJson(const UntrackedNutrients &untracked = UntrackedNutrients()) const
+    {
+        json j = json::object();
+        for (const auto &[name, value] : untracked)
+            j[name] = value;
+        for (size_t i = CALORIES + 1; i < COUNT; ++i)
+        {
+            if (values[i] != 0.0f)
+                j[string(key(i))] = values[i];
+        }
+        return j;
+    }
+
+    // Streams toJson(), keys in sorted order
+    void writeJson(JsonStreamWriter &writer, const UntrackedNutrients &untracked = UntrackedNutrients()) const
+    {
+        writer.beginObject();
+        auto other = untracked.begin();
+        for (size_t i : Schema::byKey)
+        {
+            if (i == CALORIES || values[i] == 0.0f)
+                continue;
+            for (; other != untracked.end() && other->first < key(i); ++other)
+                writer.key(other->first).value(other->second);
+            writer.key(key(i)).value(values[i]);
+        }
+        for (; other != untracked.end(); ++other)
+            writer.key(other->first).value(other->second);
+        writer.endObject();
+    }
+
+    // Reads a "nutrients" member; numeric members this build does not track
+    // go to `untracked`
+    static BasicNutrientVector fromJson(const json &j, UntrackedNutrients *untracked = nullptr)
+    {
+        BasicNutrientVector nutrients;
+        for (const auto &[name, value] : j.items())
+        {
+            size_t index = findDetail(name);
+            if (index != npos)
+                nutrients[index] = value.template get<float>();
+            else if (untracked && value.is_number())
+                untracked->emplace_back(name, value.template get<float>());
+        }
+        return nutrients;
+    }
+
+    // One line per set nutrient other than calories
+    void display(const string &indent) const
+    {
+        for (size_t i = CALORIES + 1; i < COUNT; ++i)
+        {
+            if (values[i] != 0.0f)
+                cout << indent << label(i) << ": " << values[i] << " " << unit(i) << endl;
+        }
+    }
+};
+
+using NutrientVector = BasicNutrientVector<nutrient::Tracked>;
+
+// Fused multiply-add over nutrient vectors: total += rows[i] * scales[i] for
+// every row. Uses AVX2 with FMA when the CPU has them, one register per 8
+// nutrients unrolled at compile time, otherwise a scalar loop over the
+// tracked nutrients; both round each step once, so totals match on every
+// machine.
+class NutrientKernels
+{
+private:
+    template <typename Vector>
+    static void scalar(Vector &total, const Vector *const *rows, const float *scales, size_t count)
+    {
+        for (size_t i = 0; i < count; ++i)
+        {
+            for (size_t n = 0; n < Vector::COUNT; ++n)
+                total.values[n] = fma(rows[i]->values[n], scales[i], total.values[n]);
+        }
+    }
+
+#if defined(__x86_64__)
+    template <typename Vector, size_t... R>
+    __attribute__((target("avx2,fma"))) static void avx2(Vector &total, const Vector *const *rows, const float *scales,
+                                                          size_t count, index_sequence<R...>)
+    {
+        __m256 sums[] = {_mm256_load_ps(total.values + 8 * R)...};
+        for (size_t i = 0; i < count; ++i)
+        {
+            __m256 scale = _mm256_set1_ps(scales[i]);
+            ((sums[R] = _mm256_fmadd_ps(_mm256_load_ps(rows[i]->values + 8 * R), scale, sums[R])), ...);
+        }
+        (_mm256_store_ps(total.values + 8 * R, sums[R]), ...);
+    }
+#endif
+
+public:
+    static bool vectorized()
+    {
+#if defined(__x86_64__)
+        static const bool supported = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+        return supported;
+#else
+        return false;
+#endif
+    }
+
+    template <typename Vector>
+    static void accumulate(Vector &total, const Vector *const *rows, const float *scales, size_t count)
+    {
+#if defined(__x86_64__)
+        if (vectorized())
+            return avx2(total, rows, scales, count, make_index_sequence<Vector::WIDTH / 8>());
+#endif
+        scalar(total, rows, scales, count);
+    }
+
+    template <typename Vector>
+    static void accumulate(Vector &total, const Vector &row, float scale)
+    {
+        const Vector *rows[] = {&row};
+        accumulate(total, rows, &scale, 1);
+    }
+};
+
 // Base Food class
 class Food
 {
+    friend class CompositeFood;
+
+private:
+    // Reverse edges: composites with this food as a direct component, so a
+    // change can drop their cached calories. A set, so a composite removes
+    // itself in constant time. Foods built on other threads (a background
+    // save resolves composites too) share the edges, so they and cache
+    // invalidation are guarded by graphLock().
+    mutable unordered_set<const CompositeFood *> dependents;
+
 protected:
     string name;
     vector<string> keywords;
     string type;
 
+    static mutex &graphLock()
+    {
+        static mutex lock;
+        return lock;
+    }
+
+    // Marks the cached calories of every composite containing this food stale
+    void invalidateDependents() const;
+
 public:
     Food(const string &name, const vector<string> &keywords, const string &type)
         : name(name), keywords(keywords), type(type) {}
 
     virtual ~Food() = default;
 
+    // Read-only food record in a mapped catalog snapshot
+    class View;
+
     virtual float getCalories() const = 0;
 
+    // Nutrients of one serving, calories included
+    virtual NutrientVector getNutrients() const = 0;
+
+    // Names of every composite containing this food, directly or through other composites
+    vector<string> dependentNames() const;
+
     const string &getName() const { return name; }
     const vector<string> &getKeywords() const { return keywords; }
     const string &getType() const { return type; }
@@ -75,11 +592,30 @@ public:
         return j;
     }
 
+    // Streams the same document as toJson(), keys in sorted order
+    void writeJson(JsonStreamWriter &writer) const
+    {
+        writer.beginObject();
+        writer.key("calories").value(getCalories());
+        writeComponentsJson(writer);
+        writer.key("keywords").value(keywords);
+        writer.key("name").value(name);
+        writeNutrientsJson(writer);
+        writer.key("type").value(type);
+        writer.endObject();
+    }
+
     virtual void display() const
     {
         cout << "Name: " << name << endl;
         cout << "Type: " << type << endl;
         cout << "Calories: " << getCalories() << endl;
+        NutrientVector nutrients = getNutrients();
+        if (nutrients.hasDetails())
+        {
+            cout << "Nutrients:" << endl;
+            nutrients.display("  - ");
+        }
         cout << "Keywords: ";
         for (size_t i = 0; i < keywords.size(); ++i)
         {
@@ -89,26 +625,76 @@ public:
         }
         cout << endl;
     }
+
+protected:
+    // Hook for the "components" member of composite foods
+    virtual void writeComponentsJson(JsonStreamWriter &) const {}
+
+    // Hook for the "nutrients" member of basic foods
+    virtual void writeNutrientsJson(JsonStreamWriter &) const {}
 };
 
 // Basic Food class
 class BasicFood : public Food
 {
+    friend class CompositeFood;
+
 private:
-    float calories;
+    atomic<float> calories; // read by background saves while it may change
+
+    // The other nutrients, fixed once the food is built. The calorie slot
+    // stays 0, so kernels over these rows leave calories to the caller.
+    NutrientVector nutrients;
+    UntrackedNutrients untracked;
 
 public:
-    BasicFood(const string &name, const vector<string> &keywords, float calories)
-        : Food(name, keywords, "basic"), calories(calories) {}
+    BasicFood(const string &name, const vector<string> &keywords, float calories,
+              const NutrientVector &nutrients = NutrientVector(), UntrackedNutrients untracked = UntrackedNutrients())
+        : Food(name, keywords, "basic"), calories(calories), nutrients(nutrients), untracked(move(untracked))
+    {
+        this->nutrients[NutrientVector::CALORIES] = 0.0f;
+        sort(this->untracked.begin(), this->untracked.end());
+    }
 
-    float getCalories() const override { return calories; } // to override getCalories from Food.
+    float getCalories() const override { return calories.load(memory_order_relaxed); } // to override getCalories from Food.
+
+    NutrientVector getNutrients() const override
+    {
+        NutrientVector result = nutrients;
+        result[NutrientVector::CALORIES] = getCalories();
+        return result;
+    }
+
+    void setCalories(float value)
+    {
+        calories.store(value, memory_order_relaxed);
+        invalidateDependents();
+    }
+
+    const UntrackedNutrients &getUntrackedNutrients() const { return untracked; }
+
+    json toJson() const override
+    {
+        json j = Food::toJson();
+        if (nutrients.hasDetails() || !untracked.empty())
+            j["nutrients"] = nutrients.toJson(untracked);
+        return j;
+    }
+
+    void writeNutrientsJson(JsonStreamWriter &writer) const override
+    {
+        if (nutrients.hasDetails() || !untracked.empty())
+            nutrients.writeJson(writer.key("nutrients"), untracked);
+    }
 
     static shared_ptr<BasicFood> fromJson(const json &j)
     {
         string name = j["name"];
         vector<string> keywords = j["keywords"].get<vector<string>>();
         float calories = j["calories"];
-        return make_shared<BasicFood>(name, keywords, calories);
+        UntrackedNutrients untracked;
+        NutrientVector nutrients = j.contains("nutrients") ? NutrientVector::fromJson(j["nutrients"], &untracked) : NutrientVector();
+        return make_shared<BasicFood>(name, keywords, calories, nutrients, move(untracked));
     }
 };
 
@@ -132,23 +718,119 @@ struct FoodComponent
 // Composite Food class
 class CompositeFood : public Food
 {
+    friend class Food;
+
 private:
     vector<FoodComponent> components;
 
+    // Every basic food reachable through the components, with the servings
+    // of it in one serving of this food, in first-reached order. Built from
+    // the components' own leaves, so construction is linear in their size;
+    // the structure never changes afterwards, only leaf calories do. Kept as
+    // parallel arrays so the nutrient kernel streams rows and scales.
+    vector<const BasicFood *> leafFoods;
+    vector<const NutrientVector *> leafNutrients;
+    vector<float> leafServings;
+
+    void flattenLeaves()
+    {
+        unordered_map<const BasicFood *, size_t> position;
+        auto add = [&](const BasicFood *leaf, float servings)
+        {
+            auto [it, added] = position.emplace(leaf, leafFoods.size());
+            if (added)
+            {
+                leafFoods.push_back(leaf);
+                leafNutrients.push_back(&leaf->nutrients);
+                leafServings.push_back(servings);
+            }
+            else
+            {
+                leafServings[it->second] += servings;
+            }
+        };
+        for (const auto &component : components)
+        {
+            if (auto composite = dynamic_cast<const CompositeFood *>(component.food.get()))
+            {
+                for (size_t i = 0; i < composite->leafFoods.size(); ++i)
+                    add(composite->leafFoods[i], composite->leafServings[i] * component.servings);
+            }
+            else
+            {
+                add(static_cast<const BasicFood *>(component.food.get()), component.servings);
+            }
+        }
+    }
+
+    // Total calories in the low half, NaN until computed after construction
+    // or a change below; the high half counts invalidations. Both live in one
+    // word, so a total computed from values that changed meanwhile fails to
+    // replace it, and a cache miss needs no lock.
+    mutable atomic<uint64_t> cachedCalories;
+
+    static uint64_t packCache(uint32_t version, float calories)
+    {
+        uint32_t bits;
+        memcpy(&bits, &calories, sizeof(bits));
+        return uint64_t(version) << 32 | bits;
+    }
+
+    static float cachedTotal(uint64_t cache)
+    {
+        uint32_t bits = static_cast<uint32_t>(cache);
+        float calories;
+        memcpy(&calories, &bits, sizeof(calories));
+        return calories;
+    }
+
 public:
     CompositeFood(const string &name, const vector<string> &keywords, const vector<FoodComponent> &components)
-        : Food(name, keywords, "composite"), components(components) {}
+        : Food(name, keywords, "composite"), components(components), cachedCalories(packCache(0, numeric_limits<float>::quiet_NaN()))
+    {
+        flattenLeaves();
+        lock_guard<mutex> guard(graphLock());
+        for (const auto &component : this->components)
+            component.food->dependents.insert(this);
+    }
+
+    ~CompositeFood() override
+    {
+        lock_guard<mutex> guard(graphLock());
+        for (const auto &component : components)
+            component.food->dependents.erase(this);
+    }
 
+    // A dot product over the flattened leaves, computed once until a leaf changes
     float getCalories() const override
     {
+        uint64_t cache = cachedCalories.load();
+        if (!isnan(cachedTotal(cache)))
+            return cachedTotal(cache);
+
         float totalCalories = 0.0f;
-        for (const auto &component : components)
+        for (size_t i = 0; i < leafFoods.size(); ++i)
         {
-            totalCalories += component.food->getCalories() * component.servings;
+            totalCalories += leafFoods[i]->calories.load(memory_order_relaxed) * leafServings[i];
         }
+        // Fails if an invalidation moved the version on meanwhile
+        cachedCalories.compare_exchange_strong(cache, packCache(static_cast<uint32_t>(cache >> 32), totalCalories));
         return totalCalories;
     }
 
+    // One kernel pass over the leaves; calories come from the cached total
+    NutrientVector getNutrients() const override
+    {
+        NutrientVector total;
+        NutrientKernels::accumulate(total, leafNutrients.data(), leafServings.data(), leafFoods.size());
+        total[NutrientVector::CALORIES] = getCalories();
+        return total;
+    }
+
+    const vector<FoodComponent> &getComponents() const { return components; }
+    const vector<const BasicFood *> &getLeafFoods() const { return leafFoods; }
+    const vector<float> &getLeafServings() const { return leafServings; }
+
     json toJson() const override
     {
         json j = Food::toJson();
@@ -163,6 +845,19 @@ public:
         return j;
     }
 
+    void writeComponentsJson(JsonStreamWriter &writer) const override
+    {
+        writer.key("components").beginArray();
+        for (const auto &component : components)
+        {
+            writer.beginObject();
+            writer.key("name").value(component.food->getName());
+            writer.key("servings").value(component.servings);
+            writer.endObject();
+        }
+        writer.endArray();
+    }
+
     void display() const override
     {
         Food::display();
@@ -173,6 +868,21 @@ public:
                  << " (" << component.servings << " serving"
                  << (component.servings > 1 ? "s" : "") << ")" << endl;
         }
+
+        // Nested recipes also list the basic foods they come down to
+        bool nested = any_of(components.begin(), components.end(), [](const FoodComponent &component)
+                             { return component.food->getType() == "composite"; });
+        if (nested)
+        {
+            cout << "Exploded recipe:" << endl;
+            for (size_t i = 0; i < leafFoods.size(); ++i)
+            {
+                float servings = leafServings[i];
+                cout << "  - " << leafFoods[i]->getName()
+                     << " (" << servings << " serving" << (servings > 1 ? "s" : "") << ", "
+                     << leafFoods[i]->getCalories() * servings << " calories)" << endl;
+            }
+        }
     }
 
     static shared_ptr<CompositeFood> createFromComponents(
@@ -184,405 +894,6050 @@ public:
     }
 };
 
-// Food Database Manager class
-class FoodDatabaseManager
+inline void Food::invalidateDependents() const
 {
-public:
-    map<string, shared_ptr<Food>> foods;
-
-private:
-    string databaseFilePath;
-    bool modified;
-
-    void clear()
+    lock_guard<mutex> guard(graphLock());
+    vector<const Food *> toVisit{this};
+    unordered_set<const Food *> seen;
+    while (!toVisit.empty())
     {
-        foods.clear();
+        const Food *food = toVisit.back();
+        toVisit.pop_back();
+        for (const CompositeFood *dependent : food->dependents)
+        {
+            if (!seen.insert(dependent).second)
+                continue;
+            // Only invalidation writes the version, and it holds the lock
+            uint64_t cache = dependent->cachedCalories.load();
+            dependent->cachedCalories.store(CompositeFood::packCache(static_cast<uint32_t>(cache >> 32) + 1,
+                                                                     numeric_limits<float>::quiet_NaN()));
+            toVisit.push_back(dependent);
+        }
     }
+}
 
-public:
-    FoodDatabaseManager(const string &filePath = "food_database.json")
-        : databaseFilePath(filePath), modified(false) {}
-
-    bool loadDatabase()
+inline vector<string> Food::dependentNames() const
+{
+    lock_guard<mutex> guard(graphLock());
+    vector<string> names;
+    vector<const Food *> toVisit{this};
+    unordered_set<const Food *> seen;
+    while (!toVisit.empty())
     {
-        clear();
-
-        ifstream file(databaseFilePath);
-        if (!file.is_open())
+        const Food *food = toVisit.back();
+        toVisit.pop_back();
+        for (const CompositeFood *dependent : food->dependents)
         {
-            cout << "No existing database found. Starting with empty database." << endl;
-            return false;
-        }
-
-        try
-        {
-            json j;
-            file >> j;
-
-            // Store the entire JSON data for each food
-            map<string, json> pendingFoods;
-
-            // First pass: load all basic foods and catalogue composite foods
-            for (const auto &foodJson : j)
+            if (seen.insert(dependent).second)
             {
-                string type = foodJson["type"];
-                string name = foodJson["name"];
-
-                if (type == "basic")
-                {
-                    foods[name] = BasicFood::fromJson(foodJson);
-                }
-                else if (type == "composite")
-                {
-                    pendingFoods[name] = foodJson;
-                }
+                names.push_back(dependent->getName());
+                toVisit.push_back(dependent);
             }
+        }
+    }
+    return names;
+}
 
-            // Function to recursively load a composite food and its dependencies
-            function<shared_ptr<Food>(const string &)> loadCompositeFood = [&](const string &name) -> shared_ptr<Food>
-            {
-                // If already loaded, return it
-                if (foods.find(name) != foods.end())
-                {
-                    return foods[name];
-                }
-
-                // If not a pending composite food, can't load it
-                if (pendingFoods.find(name) == pendingFoods.end())
-                {
-                    cout << "Warning: Food '" << name << "' not found." << endl;
-                    return nullptr;
-                }
+// Component of a composite food, referenced by name until it is resolved
+struct ComponentRef
+{
+    string name;
+    float servings;
+};
 
-                // Get the food's JSON
-                json foodJson = pendingFoods[name];
+// Composite food read from the catalog whose components are not resolved yet
+struct PendingComposite
+{
+    string name;
+    vector<string> keywords;
+    vector<ComponentRef> components;
 
-                // Load all components
-                vector<FoodComponent> components;
-                for (const auto &componentJson : foodJson["components"])
-                {
-                    string componentName = componentJson["name"];
-                    float servings = componentJson["servings"];
+    static PendingComposite fromJson(const json &j)
+    {
+        PendingComposite composite{j["name"], j["keywords"].get<vector<string>>(), {}};
+        for (const auto &componentJson : j["components"])
+        {
+            composite.components.push_back({componentJson["name"], componentJson["servings"]});
+        }
+        return composite;
+    }
+};
 
-                    // Recursively load component if needed
-                    shared_ptr<Food> componentFood;
-                    if (foods.find(componentName) != foods.end())
-                    {
-                        componentFood = foods[componentName];
-                    }
-                    else
-                    {
-                        componentFood = loadCompositeFood(componentName);
-                    }
+// SAX handler building foods directly from parse events (no json DOM).
+// Basic foods are created right away, composites are kept as PendingComposite
+// descriptors so they can be resolved once every food has been seen.
+class FoodCatalogSaxHandler final : public nlohmann::json_sax<json>
+{
+private:
+    enum class Field
+    {
+        NONE,
+        NAME,
+        TYPE,
+        CALORIES,
+        KEYWORDS,
+        COMPONENTS,
+        SERVINGS,
+        NUTRIENTS,
+        OTHER
+    };
 
-                    if (componentFood)
-                    {
-                        components.emplace_back(componentFood, servings);
-                    }
-                    else
-                    {
-                        cout << "Warning: Component '" << componentName
-                             << "' not found for composite food '" << name << "'" << endl;
-                    }
-                }
+    // Nesting depths (after entering the container) inside the top-level array
+    static constexpr size_t FOOD_DEPTH = 2;
+    static constexpr size_t KEYWORD_DEPTH = 3;
+    static constexpr size_t NUTRIENT_DEPTH = 3;
+    static constexpr size_t COMPONENT_DEPTH = 4;
+
+    map<std::string, shared_ptr<Food>> &basicFoods;
+    map<std::string, PendingComposite> &pendingFoods;
+
+    size_t depth;
+    Field field = Field::NONE;
+    Field componentField = Field::NONE;
+
+    // Food currently being parsed
+    std::string name;
+    std::string type;
+    float calories = 0.0f;
+    NutrientVector nutrients;
+    size_t nutrient = NutrientVector::npos; // member being read, npos if untracked
+    std::string untrackedKey;
+    UntrackedNutrients untracked;
+    vector<std::string> keywords;
+    vector<ComponentRef> components;
+    bool hasName = false;
+    bool hasType = false;
+    bool hasCalories = false;
+    bool hasKeywords = false;
+
+    // Component currently being parsed
+    ComponentRef component;
+    bool hasComponentName = false;
+    bool hasComponentServings = false;
+
+    static Field fieldFor(const std::string &key)
+    {
+        if (key == "name")
+            return Field::NAME;
+        if (key == "type")
+            return Field::TYPE;
+        if (key == "calories")
+            return Field::CALORIES;
+        if (key == "keywords")
+            return Field::KEYWORDS;
+        if (key == "components")
+            return Field::COMPONENTS;
+        if (key == "servings")
+            return Field::SERVINGS;
+        if (key == "nutrients")
+            return Field::NUTRIENTS;
+        return Field::OTHER;
+    }
 
-                // Create the composite food
-                vector<string> keywords = foodJson["keywords"].get<vector<string>>();
-                shared_ptr<Food> food = make_shared<CompositeFood>(name, keywords, components);
+    bool inComponent() const
+    {
+        return depth == COMPONENT_DEPTH && field == Field::COMPONENTS;
+    }
 
-                // Add it to loaded foods
-                foods[name] = food;
+    bool inNutrients() const
+    {
+        return depth == NUTRIENT_DEPTH && field == Field::NUTRIENTS;
+    }
 
-                return food;
-            };
+    void beginFood()
+    {
+        name.clear();
+        type.clear();
+        calories = 0.0f;
+        nutrients = NutrientVector();
+        untracked.clear();
+        keywords.clear();
+        components.clear();
+        hasName = hasType = hasCalories = hasKeywords = false;
+        field = Field::NONE;
+    }
 
-            // Second pass: load all composite foods with dependencies
-            for (const auto &[name, _] : pendingFoods)
-            {
-                loadCompositeFood(name);
-            }
+    void finishFood()
+    {
+        if (!hasName || !hasType)
+            throw runtime_error("food entry is missing its 'name' or 'type'");
 
-            cout << "Database loaded: " << foods.size() << " foods." << endl;
-            return true;
+        if (type == "basic")
+        {
+            if (!hasKeywords || !hasCalories)
+                throw runtime_error("basic food '" + name + "' is missing 'keywords' or 'calories'");
+            basicFoods[name] = make_shared<BasicFood>(name, keywords, calories, nutrients, move(untracked));
         }
-        catch (const exception &e)
+        else if (type == "composite")
         {
-            cout << "Error loading database: " << e.what() << endl;
-            return false;
+            if (!hasKeywords)
+                throw runtime_error("composite food '" + name + "' is missing 'keywords'");
+            PendingComposite &pending = pendingFoods[name];
+            pending.name = name;
+            pending.keywords = move(keywords);
+            pending.components = move(components);
         }
     }
 
-    bool saveDatabase()
+    bool number(double value)
     {
-        try
+        if (depth == FOOD_DEPTH && field == Field::CALORIES)
         {
-            json j = json::array();
-
-            for (const auto &[name, food] : foods)
-            {
-                j.push_back(food->toJson());
-            }
-
-            ofstream file(databaseFilePath);
-            if (!file.is_open())
-            {
-                cout << "Error: Unable to open file for writing." << endl;
-                return false;
-            }
-
-            file << j.dump(4); // Pretty print with 4 spaces
-            file.close();
-
-            modified = false;
-            cout << "Database saved to " << databaseFilePath << endl;
-            return true;
+            calories = static_cast<float>(value);
+            hasCalories = true;
         }
-        catch (const exception &e)
+        else if (inComponent() && componentField == Field::SERVINGS)
         {
-            cout << "Error saving database: " << e.what() << endl;
-            return false;
+            component.servings = static_cast<float>(value);
+            hasComponentServings = true;
+        }
+        else if (inNutrients() && nutrient != NutrientVector::npos)
+        {
+            nutrients[nutrient] = static_cast<float>(value);
+        }
+        else if (inNutrients())
+        {
+            untracked.emplace_back(move(untrackedKey), static_cast<float>(value));
         }
+        return true;
     }
 
-    bool addFood(shared_ptr<Food> food)
+public:
+    // With `elementsOnly`, the input is a single element of the food array
+    // rather than the whole array (used by the chunked parallel loader)
+    FoodCatalogSaxHandler(map<std::string, shared_ptr<Food>> &basics, map<std::string, PendingComposite> &pending,
+                          bool elementsOnly = false)
+        : basicFoods(basics), pendingFoods(pending), depth(elementsOnly ? 1 : 0) {}
+
+    bool null() override { return true; }
+    bool boolean(bool) override { return true; }
+    bool number_integer(number_integer_t value) override { return number(static_cast<double>(value)); }
+    bool number_unsigned(number_unsigned_t value) override { return number(static_cast<double>(value)); }
+    bool number_float(number_float_t value, const string_t &) override { return number(value); }
+    bool binary(binary_t &) override { return true; }
+
+    bool string(string_t &value) override
     {
-        string name = food->getName();
-        if (foods.find(name) != foods.end())
+        if (depth == FOOD_DEPTH && field == Field::NAME)
         {
-            cout << "Error: A food with name '" << name << "' already exists." << endl;
-            return false;
+            name = move(value);
+            hasName = true;
+        }
+        else if (depth == FOOD_DEPTH && field == Field::TYPE)
+        {
+            type = move(value);
+            hasType = true;
+        }
+        else if (depth == KEYWORD_DEPTH && field == Field::KEYWORDS)
+        {
+            keywords.push_back(move(value));
+        }
+        else if (inComponent() && componentField == Field::NAME)
+        {
+            component.name = move(value);
+            hasComponentName = true;
         }
-
-        foods[name] = food;
-        modified = true;
         return true;
     }
 
-    vector<shared_ptr<Food>> searchFoodsByKeywords(const vector<string> &keywords, bool matchall)
+    bool start_object(size_t) override
     {
-        vector<shared_ptr<Food>> results;
-        // if matchall is there, we need foods with all keywords, else food which atleast one keyword
-        for (const auto &[name, food] : foods)
+        ++depth;
+        if (depth == 1)
+            throw runtime_error("food database must be a JSON array");
+
+        if (depth == FOOD_DEPTH)
         {
-            int cnt = 0;
-            for (auto &keyword : keywords)
-            {
-                string lowerKeyword = keyword;
-                transform(lowerKeyword.begin(), lowerKeyword.end(), lowerKeyword.begin(), ::tolower);
-                for (const auto &foodKeyword : food->getKeywords())
-                {
-                    string lowerFoodKeyword = foodKeyword;
-                    transform(lowerFoodKeyword.begin(), lowerFoodKeyword.end(), lowerFoodKeyword.begin(), ::tolower);
-                    if (lowerFoodKeyword.find(lowerKeyword) != string::npos)
-                    {
-                        cnt++;
-                        break;
-                    }
-                }
-            }
-            if (matchall && cnt == keywords.size())
-            {
-                results.push_back(food);
-            }
-            else if (!matchall && cnt > 0)
-            {
-                results.push_back(food);
-            }
+            beginFood();
         }
-        return results;
+        else if (inComponent())
+        {
+            component = ComponentRef{"", 0.0f};
+            componentField = Field::NONE;
+            hasComponentName = hasComponentServings = false;
+        }
+        return true;
     }
 
-    shared_ptr<Food> getFood(const string &name)
+    bool key(string_t &key) override
     {
-        auto it = foods.find(name);
-        if (it != foods.end())
+        if (depth == FOOD_DEPTH)
         {
-            return it->second;
+            field = fieldFor(key);
+        }
+        else if (inComponent())
+        {
+            componentField = fieldFor(key);
+        }
+        else if (inNutrients())
+        {
+            // Calories are a member of the food itself; untracked nutrients are kept as they are
+            nutrient = NutrientVector::findDetail(key);
+            untrackedKey = nutrient == NutrientVector::npos ? key : std::string();
         }
-        return nullptr;
+        return true;
     }
 
-    void listAllFoods() const
+    bool end_object() override
     {
-        cout << "\n=== All Foods in Database (" << foods.size() << ") ===" << endl;
-        for (const auto &[name, food] : foods)
+        if (depth == FOOD_DEPTH)
         {
-            cout << name << " (" << food->getType() << ") - " << food->getCalories() << " calories" << endl;
+            finishFood();
         }
-        cout << "===========================" << endl;
+        else if (inComponent())
+        {
+            if (!hasComponentName || !hasComponentServings)
+                throw runtime_error("component of '" + name + "' is missing 'name' or 'servings'");
+            components.push_back(move(component));
+        }
+        --depth;
+        return true;
     }
 
-    bool isModified() const
+    bool start_array(size_t) override
     {
-        return modified;
+        ++depth;
+        if (depth == KEYWORD_DEPTH && field == Field::KEYWORDS)
+            hasKeywords = true;
+        return true;
     }
-};
 
-// Food log entry for a specific day
-class FoodEntry
-{
-public:
-    string foodName;
-    double servings;
-    double calories;
+    bool end_array() override
+    {
+        --depth;
+        return true;
+    }
 
-    FoodEntry(const string &name, double servs, double cals)
-        : foodName(name), servings(servs), calories(cals) {}
+    bool parse_error(size_t, const std::string &, const nlohmann::detail::exception &ex) override
+    {
+        throw runtime_error(ex.what());
+    }
 };
 
-// Date handling utility
-class DateUtil
+// Cursor over JSON text for the fixed document shapes this program writes.
+// Whitespace and string bodies are scanned 16 bytes at a time with SSE2 and
+// numbers are converted with from_chars. Anything outside the strict JSON
+// grammar, or that the callers do not expect (\u escapes, duplicate keys,
+// unknown members), throws Miss so the caller can hand the text to nlohmann,
+// which accepts or rejects it with its usual diagnostics.
+class FastJsonReader
 {
 public:
-    static string getCurrentDate()
+    struct Miss
     {
-        auto now = chrono::system_clock::now();
-        auto time = chrono::system_clock::to_time_t(now);
-        tm tm = *localtime(&time);
+    };
 
-        stringstream ss;
-        ss << put_time(&tm, "%Y-%m-%d");
-        return ss.str();
-    }
+private:
+    const char *at;
+    const char *end;
 
-    static bool isValidDate(const string &dateStr)
+    static bool isWhitespace(char c)
     {
-        if (dateStr.length() != 10)
-            return false;
+        return c == ' ' || c == '\n' || c == '\r' || c == '\t';
+    }
 
-        // Check format: YYYY-MM-DD
-        for (int i = 0; i < 10; i++)
+    // Rejects malformed UTF-8, which nlohmann refuses too
+    static bool validUtf8(string_view text)
+    {
+        for (size_t i = 0; i < text.size();)
         {
-            if ((i == 4 || i == 7) && dateStr[i] != '-')
+            unsigned char c = text[i];
+            size_t length = c < 0x80 ? 1 : (c >> 5) == 0x6 ? 2 : (c >> 4) == 0xe ? 3 : (c >> 3) == 0x1e ? 4 : 0;
+            if (length == 0 || i + length > text.size())
                 return false;
-            else if (i != 4 && i != 7 && !isdigit(dateStr[i]))
+            uint32_t code = length == 1 ? c : c & (0x7f >> length);
+            for (size_t k = 1; k < length; ++k)
+            {
+                unsigned char next = text[i + k];
+                if ((next & 0xc0) != 0x80)
+                    return false;
+                code = (code << 6) | (next & 0x3f);
+            }
+            static constexpr uint32_t smallest[] = {0, 0, 0x80, 0x800, 0x10000};
+            if (code < smallest[length] || code > 0x10ffff || (code >= 0xd800 && code <= 0xdfff))
                 return false;
+            i += length;
+        }
+        return true;
+    }
+
+public:
+    FastJsonReader(const char *begin, const char *finish) : at(begin), end(finish) {}
+
+    const char *position() const { return at; }
+
+    void skipWhitespace()
+    {
+#if defined(__SSE2__)
+        while (end - at >= 16 && isWhitespace(*at))
+        {
+            __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(at));
+            __m128i space = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(bytes, _mm_set1_epi8(' ')), _mm_cmpeq_epi8(bytes, _mm_set1_epi8('\n'))),
+                                         _mm_or_si128(_mm_cmpeq_epi8(bytes, _mm_set1_epi8('\r')), _mm_cmpeq_epi8(bytes, _mm_set1_epi8('\t'))));
+            unsigned other = ~static_cast<unsigned>(_mm_movemask_epi8(space)) & 0xffff;
+            if (other)
+            {
+                at += __builtin_ctz(other);
+                return;
+            }
+            at += 16;
         }
+#endif
+        while (at < end && isWhitespace(*at))
+            ++at;
+    }
 
-        int year = stoi(dateStr.substr(0, 4));
-        int month = stoi(dateStr.substr(5, 2));
-        int day = stoi(dateStr.substr(8, 2));
+    // Next significant character, or '\0' at the end of the text
+    char peek()
+    {
+        skipWhitespace();
+        return at < end ? *at : '\0';
+    }
 
-        if (month < 1 || month > 12)
+    void expect(char c)
+    {
+        if (peek() != c)
+            throw Miss();
+        ++at;
+    }
+
+    bool consume(char c)
+    {
+        if (peek() != c)
             return false;
+        ++at;
+        return true;
+    }
 
-        int daysInMonth[] = {0, 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+    bool atEnd()
+    {
+        return peek() == '\0' && at == end;
+    }
 
-        // Adjust for leap year
-        if (month == 2 && ((year % 4 == 0 && year % 100 != 0) || year % 400 == 0))
+    string readString()
+    {
+        expect('"');
+        string text;
+        bool ascii = true;
+        while (true)
         {
-            daysInMonth[2] = 29;
+            // Length of the plain run before the next quote, backslash or control character
+            const char *run = at;
+#if defined(__SSE2__)
+            while (end - at >= 16)
+            {
+                __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(at));
+                __m128i special = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(bytes, _mm_set1_epi8('"')), _mm_cmpeq_epi8(bytes, _mm_set1_epi8('\\'))),
+                                               _mm_cmpeq_epi8(_mm_max_epu8(bytes, _mm_set1_epi8(0x1f)), _mm_set1_epi8(0x1f)));
+                unsigned stop = static_cast<unsigned>(_mm_movemask_epi8(special));
+                unsigned high = static_cast<unsigned>(_mm_movemask_epi8(bytes));
+                if (stop)
+                {
+                    ascii = ascii && !(high & ((stop & -stop) - 1));
+                    at += __builtin_ctz(stop);
+                    break;
+                }
+                ascii = ascii && !high;
+                at += 16;
+            }
+#endif
+            while (at < end && *at != '"' && *at != '\\' && static_cast<unsigned char>(*at) >= 0x20)
+            {
+                ascii = ascii && static_cast<unsigned char>(*at) < 0x80;
+                ++at;
+            }
+            text.append(run, at);
+            if (at == end || static_cast<unsigned char>(*at) < 0x20)
+                throw Miss();
+            if (*at++ == '"')
+                break;
+
+            if (at == end)
+                throw Miss();
+            switch (*at++)
+            {
+            case '"': text += '"'; break;
+            case '\\': text += '\\'; break;
+            case '/': text += '/'; break;
+            case 'b': text += '\b'; break;
+            case 'f': text += '\f'; break;
+            case 'n': text += '\n'; break;
+            case 'r': text += '\r'; break;
+            case 't': text += '\t'; break;
+            default: throw Miss(); // \\u escapes are left to nlohmann
+            }
         }
+        if (!ascii && !validUtf8(text))
+            throw Miss();
+        return text;
+    }
 
-        return day >= 1 && day <= daysInMonth[month];
+    // A JSON number as nlohmann hands it to get<double>(); `integer` tells
+    // whether it was written without fraction or exponent
+    double readNumber(bool *integer = nullptr)
+    {
+        skipWhitespace();
+        const char *start = at, *p = at;
+        auto digits = [&]()
+        {
+            const char *first = p;
+            while (p < end && *p >= '0' && *p <= '9')
+                ++p;
+            return p - first;
+        };
+        if (p < end && *p == '-')
+            ++p;
+        if (p < end && *p == '0')
+            ++p;
+        else if (digits() == 0)
+            throw Miss();
+        bool whole = true;
+        if (p < end && *p == '.')
+        {
+            ++p;
+            whole = false;
+            if (digits() == 0)
+                throw Miss();
+        }
+        if (p < end && (*p == 'e' || *p == 'E'))
+        {
+            ++p;
+            whole = false;
+            if (p < end && (*p == '+' || *p == '-'))
+                ++p;
+            if (digits() == 0)
+                throw Miss();
+        }
+
+        double value;
+        auto parsed = from_chars(start, p, value);
+        if (parsed.ec != errc() || parsed.ptr != p)
+            throw Miss();
+        at = p;
+        if (integer)
+            *integer = whole;
+        // nlohmann reads "-0" as the integer 0
+        return whole && value == 0.0 ? 0.0 : value;
     }
-};
 
-// Command interface for undo functionality
-class Command
-{
-public:
-    virtual ~Command() = default;
-    virtual void execute() = 0;
-    virtual void undo() = 0;
-    virtual string getDescription() const = 0;
-};
+    // An integer literal in int range, as get<int>() would read it
+    int readInt()
+    {
+        bool integer;
+        double value = readNumber(&integer);
+        if (!integer || value < numeric_limits<int>::min() || value > numeric_limits<int>::max())
+            throw Miss();
+        return static_cast<int>(value);
+    }
+
+    bool readNull()
+    {
+        skipWhitespace();
+        if (end - at < 4 || memcmp(at, "null", 4) != 0)
+            return false;
+        at += 4;
+        return true;
+    }
+
+    // Calls member(key) for each member of an object; member must consume the value
+    template <typename Fn>
+    void readObject(Fn member)
+    {
+        expect('{');
+        if (consume('}'))
+            return;
+        do
+        {
+            string key = readString();
+            expect(':');
+            member(key);
+        } while (consume(','));
+        expect('}');
+    }
+
+    // Calls element() for each element of an array; element must consume it
+    template <typename Fn>
+    void readArray(Fn element)
+    {
+        expect('[');
+        if (consume(']'))
+            return;
+        do
+        {
+            element();
+        } while (consume(','));
+        expect(']');
+    }
+
+    vector<string> readStrings()
+    {
+        vector<string> texts;
+        readArray([&]()
+                  { texts.push_back(readString()); });
+        return texts;
+    }
+
+    // Steps over any well-formed value
+    void skipValue()
+    {
+        switch (peek())
+        {
+        case '{':
+            readObject([&](const string &)
+                       { skipValue(); });
+            break;
+        case '[':
+            readArray([&]()
+                      { skipValue(); });
+            break;
+        case '"':
+            readString();
+            break;
+        case 't':
+        case 'f':
+        {
+            string_view word = peek() == 't' ? "true" : "false";
+            if (size_t(end - at) < word.size() || string_view(at, word.size()) != word)
+                throw Miss();
+            at += word.size();
+            break;
+        }
+        default:
+            if (!readNull())
+                readNumber();
+        }
+    }
+};
+
+// Fast path for the food array: builds exactly the foods FoodCatalogSaxHandler
+// would, falling back to it element by element when an element strays from
+// the shape saveDatabase writes
+class FoodCatalogFastParser
+{
+private:
+    // One food read off the fast path, not yet added to the maps
+    struct Element
+    {
+        string name, type;
+        float calories = 0.0f;
+        NutrientVector nutrients;
+        UntrackedNutrients untracked;
+        vector<string> keywords;
+        vector<ComponentRef> components;
+    };
+
+    // Reads one array element, throwing Miss if it must go through the SAX
+    // handler instead
+    static void read(FastJsonReader &reader, Element &element)
+    {
+        string &name = element.name, &type = element.type;
+        float &calories = element.calories;
+        NutrientVector &nutrients = element.nutrients;
+        UntrackedNutrients &untracked = element.untracked;
+        vector<string> &keywords = element.keywords;
+        vector<ComponentRef> &components = element.components;
+        unsigned seen = 0;
+        auto once = [&](unsigned bit)
+        {
+            if (seen & bit)
+                throw FastJsonReader::Miss();
+            seen |= bit;
+        };
+
+        reader.readObject([&](const string &key)
+                          {
+            if (key == "name")
+            {
+                once(1);
+                name = reader.readString();
+            }
+            else if (key == "type")
+            {
+                once(2);
+                type = reader.readString();
+            }
+            else if (key == "calories")
+            {
+                once(4);
+                calories = static_cast<float>(reader.readNumber());
+            }
+            else if (key == "keywords")
+            {
+                once(8);
+                keywords = reader.readStrings();
+            }
+            else if (key == "components")
+            {
+                once(16);
+                reader.readArray([&]()
+                                 {
+                    ComponentRef component{"", 0.0f};
+                    unsigned fields = 0;
+                    reader.readObject([&](const string &field)
+                                      {
+                        if (field == "name" && !(fields & 1))
+                            component.name = reader.readString();
+                        else if (field == "servings" && !(fields & 2))
+                            component.servings = static_cast<float>(reader.readNumber());
+                        else
+                            throw FastJsonReader::Miss();
+                        fields |= field == "name" ? 1 : 2; });
+                    if (fields != 3)
+                        throw FastJsonReader::Miss();
+                    components.push_back(move(component)); });
+            }
+            else if (key == "nutrients")
+            {
+                once(32);
+                bitset<NutrientVector::COUNT> set;
+                reader.readObject([&](const string &nutrient)
+                                  {
+                    size_t index = NutrientVector::findDetail(nutrient);
+                    if (index == NutrientVector::npos)
+                    {
+                        untracked.emplace_back(nutrient, static_cast<float>(reader.readNumber()));
+                        return;
+                    }
+                    if (set.test(index))
+                        throw FastJsonReader::Miss();
+                    set.set(index);
+                    nutrients[index] = static_cast<float>(reader.readNumber()); });
+            }
+            else
+            {
+                throw FastJsonReader::Miss();
+            } });
+
+        // Incomplete or unknown foods take the SAX path, which reports or skips them
+        if (!(type == "basic" && (seen & 13) == 13) && !(type == "composite" && (seen & 11) == 11))
+            throw FastJsonReader::Miss();
+    }
+
+    static void insert(Element &element, map<string, shared_ptr<Food>> &basics, map<string, PendingComposite> &pending)
+    {
+        if (element.type == "basic")
+            basics[element.name] = make_shared<BasicFood>(element.name, element.keywords, element.calories,
+                                                          element.nutrients, move(element.untracked));
+        else
+            pending[element.name] = PendingComposite{element.name, move(element.keywords), move(element.components)};
+    }
+
+public:
+    // Parses one array element; false (with the maps untouched) if it must go
+    // through the SAX handler instead
+    static bool parseElement(FastJsonReader &reader, map<string, shared_ptr<Food>> &basics,
+                             map<string, PendingComposite> &pending)
+    {
+        Element element;
+        read(reader, element);
+        insert(element, basics, pending);
+        return true;
+    }
+
+    // Parses an element spanning exactly [begin, end); trailing data is
+    // checked before anything is added, so a miss leaves the maps untouched
+    static bool parseElement(const char *begin, const char *end, map<string, shared_ptr<Food>> &basics,
+                             map<string, PendingComposite> &pending)
+    {
+        try
+        {
+            FastJsonReader reader(begin, end);
+            Element element;
+            read(reader, element);
+            if (!reader.atEnd())
+                return false;
+            insert(element, basics, pending);
+            return true;
+        }
+        catch (const FastJsonReader::Miss &)
+        {
+            return false;
+        }
+    }
+
+    // Parses a whole food array. Elements off the fast path are parsed with the
+    // SAX handler; false if the text is not a well-formed array at all.
+    static bool parse(const char *data, size_t size, map<string, shared_ptr<Food>> &basics,
+                      map<string, PendingComposite> &pending)
+    {
+        try
+        {
+            FastJsonReader reader(data, data + size);
+            reader.readArray([&]()
+                             {
+                reader.skipWhitespace();
+                const char *start = reader.position();
+                bool fast = false;
+                try
+                {
+                    fast = parseElement(reader, basics, pending);
+                }
+                catch (const FastJsonReader::Miss &)
+                {
+                }
+                if (!fast)
+                {
+                    FastJsonReader element(start, data + size);
+                    element.skipValue();
+                    reader = element;
+                    FoodCatalogSaxHandler handler(basics, pending, true);
+                    json::sax_parse(start, reader.position(), &handler);
+                } });
+            return reader.atEnd();
+        }
+        catch (const FastJsonReader::Miss &)
+        {
+            return false;
+        }
+    }
+};
+
+// Size and modification time of a file, used to detect stale derived files
+struct FileStamp
+{
+    uint64_t size = 0;
+    int64_t mtimeNs = 0;
+
+    static bool of(const string &path, FileStamp &stamp)
+    {
+        struct stat st;
+        if (::stat(path.c_str(), &st) != 0)
+            return false;
+        stamp.size = static_cast<uint64_t>(st.st_size);
+        stamp.mtimeNs = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+        return true;
+    }
+
+    bool operator==(const FileStamp &other) const
+    {
+        return size == other.size && mtimeNs == other.mtimeNs;
+    }
+};
+
+// Read-only memory mapping of a whole file
+class MappedFile
+{
+private:
+    const char *data;
+    size_t length;
+
+public:
+    MappedFile() : data(nullptr), length(0) {}
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    ~MappedFile()
+    {
+        unmap();
+    }
+
+    bool map(const string &path)
+    {
+        unmap();
+
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+
+        struct stat st;
+        if (::fstat(fd, &st) != 0 || st.st_size == 0)
+        {
+            ::close(fd);
+            return false;
+        }
+
+        void *addr = ::mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (addr == MAP_FAILED)
+            return false;
+
+        data = static_cast<const char *>(addr);
+        length = static_cast<size_t>(st.st_size);
+        return true;
+    }
+
+    void unmap()
+    {
+        if (data)
+            ::munmap(const_cast<char *>(data), length);
+        data = nullptr;
+        length = 0;
+    }
+
+    const char *begin() const { return data; }
+    size_t size() const { return length; }
+};
+
+// CRC32C (Castagnoli). Uses the SSE4.2 crc32 instruction when the CPU has it,
+// otherwise a slicing-by-8 table.
+class Crc32c
+{
+private:
+    static constexpr uint32_t POLY = 0x82F63B78; // reflected
+
+    static const array<array<uint32_t, 256>, 8> &tables()
+    {
+        static const auto built = []
+        {
+            array<array<uint32_t, 256>, 8> t{};
+            for (uint32_t i = 0; i < 256; ++i)
+            {
+                uint32_t crc = i;
+                for (int bit = 0; bit < 8; ++bit)
+                    crc = (crc >> 1) ^ (POLY & (0u - (crc & 1)));
+                t[0][i] = crc;
+            }
+            for (uint32_t i = 0; i < 256; ++i)
+            {
+                for (int k = 1; k < 8; ++k)
+                    t[k][i] = (t[k - 1][i] >> 8) ^ t[0][t[k - 1][i] & 0xFF];
+            }
+            return t;
+        }();
+        return built;
+    }
+
+    static uint32_t software(uint32_t crc, const unsigned char *p, size_t n)
+    {
+        const auto &t = tables();
+        while (n >= 8)
+        {
+            uint32_t low, high;
+            memcpy(&low, p, 4);
+            memcpy(&high, p + 4, 4);
+            low ^= crc; // little-endian
+            crc = t[7][low & 0xFF] ^ t[6][(low >> 8) & 0xFF] ^ t[5][(low >> 16) & 0xFF] ^ t[4][low >> 24] ^
+                  t[3][high & 0xFF] ^ t[2][(high >> 8) & 0xFF] ^ t[1][(high >> 16) & 0xFF] ^ t[0][high >> 24];
+            p += 8;
+            n -= 8;
+        }
+        while (n--)
+            crc = (crc >> 8) ^ t[0][(crc ^ *p++) & 0xFF];
+        return crc;
+    }
+
+#if defined(__x86_64__)
+    __attribute__((target("sse4.2"))) static uint32_t hardware(uint32_t crc, const unsigned char *p, size_t n)
+    {
+        uint64_t wide = crc;
+        while (n >= 8)
+        {
+            uint64_t word;
+            memcpy(&word, p, 8);
+            wide = _mm_crc32_u64(wide, word);
+            p += 8;
+            n -= 8;
+        }
+        crc = static_cast<uint32_t>(wide);
+        while (n--)
+            crc = _mm_crc32_u8(crc, *p++);
+        return crc;
+    }
+#endif
+
+public:
+    static bool hardwareAccelerated()
+    {
+#if defined(__x86_64__)
+        static const bool supported = __builtin_cpu_supports("sse4.2");
+        return supported;
+#else
+        return false;
+#endif
+    }
+
+    // CRC of `data` continuing from `crc`, the CRC of the preceding bytes
+    static uint32_t extend(uint32_t crc, const void *data, size_t size)
+    {
+        const auto *p = static_cast<const unsigned char *>(data);
+        crc = ~crc;
+#if defined(__x86_64__)
+        if (hardwareAccelerated())
+            return ~hardware(crc, p, size);
+#endif
+        return ~software(crc, p, size);
+    }
+
+    static uint32_t compute(const void *data, size_t size)
+    {
+        return extend(0, data, size);
+    }
+
+    static uint32_t compute(string_view text)
+    {
+        return compute(text.data(), text.size());
+    }
+};
+
+// Integrity of persisted data files. Each file written by PersistenceWorker
+// gets a "<file>.crc" sidecar holding its CRC32C and size, and the previous
+// good version is kept as "<file>.bak". Loaders call recover() first, which
+// swaps a corrupt file for its backup instead of starting empty.
+class DataIntegrity
+{
+public:
+    enum class Status
+    {
+        VERIFIED,  // checksum matches
+        UNCHECKED, // no sidecar, e.g. written by an older version
+        EDITED,    // checksum stale, but the file was rewritten since and still parses: changed by hand
+        CORRUPT,
+        MISSING
+    };
+
+    static string sidecarPath(const string &path) { return path + ".crc"; }
+    static string backupPath(const string &path) { return path + ".bak"; }
+
+    // The sidecar also records the modification time the file is given, so a
+    // mismatch can tell a file rewritten since (a hand edit) from damage to a
+    // file nobody touched
+    static string sidecarFor(string_view contents, int64_t mtimeNs)
+    {
+        char line[96];
+        snprintf(line, sizeof(line), "crc32c %08x %llu %lld\n", Crc32c::compute(contents),
+                 static_cast<unsigned long long>(contents.size()), static_cast<long long>(mtimeNs));
+        return line;
+    }
+
+    // Modification time for a file about to be written; whole seconds, so
+    // every file system stores it exactly
+    static int64_t newStamp()
+    {
+        return static_cast<int64_t>(::time(nullptr)) * 1000000000;
+    }
+
+    // Gives an open file the modification time recorded in its sidecar
+    static bool stampFile(int fd, int64_t mtimeNs)
+    {
+        timespec times[2] = {{0, UTIME_OMIT}, {static_cast<time_t>(mtimeNs / 1000000000), static_cast<long>(mtimeNs % 1000000000)}};
+        return ::futimens(fd, times) == 0;
+    }
+
+    static Status verify(const string &path)
+    {
+        struct stat st;
+        if (::stat(path.c_str(), &st) != 0)
+            return Status::MISSING;
+
+        ifstream sidecar(sidecarPath(path));
+        if (!sidecar.is_open())
+            return Status::UNCHECKED;
+        string tag;
+        uint32_t expected = 0;
+        unsigned long long size = 0;
+        if (!(sidecar >> tag >> hex >> expected >> dec >> size) || tag != "crc32c")
+            return Status::CORRUPT;
+        // Sidecars written before modification times were recorded lack one
+        long long mtimeNs = -1;
+        if (!(sidecar >> mtimeNs))
+            mtimeNs = -1;
+        int64_t actualNs = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+        bool rewritten = size != static_cast<unsigned long long>(st.st_size) || (mtimeNs >= 0 && mtimeNs != actualNs);
+
+        if (size != static_cast<unsigned long long>(st.st_size))
+            return mismatch(path, rewritten);
+        if (size == 0)
+            return expected == Crc32c::compute("", 0) ? Status::VERIFIED : mismatch(path, rewritten);
+
+        MappedFile mapped;
+        if (!mapped.map(path) || mapped.size() != size)
+            return mismatch(path, rewritten);
+        return Crc32c::compute(mapped.begin(), mapped.size()) == expected ? Status::VERIFIED : mismatch(path, rewritten);
+    }
+
+    // Makes `path` loadable: a corrupt file is moved aside to "<file>.corrupt"
+    // and replaced by its backup if that verifies. Returns false when a
+    // corrupt file had no usable backup.
+    static bool recover(const string &path, ostream &out)
+    {
+        Status status = verify(path);
+        if (status == Status::VERIFIED || status == Status::UNCHECKED)
+            return true;
+        if (status == Status::EDITED)
+        {
+            // Keep the edit: the file is the interchange format, so a hand edit is legitimate
+            out << "Warning: " << path << " was changed outside Diet Assistant; using it as it is." << endl;
+            if (!restamp(path))
+                out << "Warning: Unable to update the checksum of " << path << "." << endl;
+            return true;
+        }
+
+        string backup = backupPath(path);
+        if (status == Status::CORRUPT)
+        {
+            string quarantine = path + ".corrupt";
+            ::rename(path.c_str(), quarantine.c_str());
+            ::remove(sidecarPath(path).c_str());
+            out << "Warning: " << path << " failed its checksum and was moved to " << quarantine << "." << endl;
+        }
+
+        Status backupStatus = verify(backup);
+        if (backupStatus == Status::VERIFIED || backupStatus == Status::UNCHECKED)
+        {
+            ifstream file(backup, ios::binary);
+            stringstream contents;
+            contents << file.rdbuf();
+            if (file.good() && writeRestored(path, contents.str()))
+            {
+                out << "Restored " << path << " from its last good copy " << backup << "." << endl;
+                return true;
+            }
+        }
+
+        if (status == Status::CORRUPT)
+        {
+            out << "Warning: No good backup of " << path << " was found." << endl;
+            return false;
+        }
+        return true;
+    }
+
+private:
+    static bool writeRestored(const string &path, const string &contents);
+
+    // A checksum mismatch is a hand edit only if the file was rewritten since
+    // its sidecar (new size or modification time) and is still valid JSON;
+    // anything else, such as a flipped bit in a file nobody touched, is damage
+    static Status mismatch(const string &path, bool rewritten)
+    {
+        if (!rewritten || path.size() < 5 || path.compare(path.size() - 5, 5, ".json") != 0)
+            return Status::CORRUPT;
+        MappedFile mapped;
+        if (!mapped.map(path) || !json::accept(mapped.begin(), mapped.begin() + mapped.size()))
+            return Status::CORRUPT;
+        return Status::EDITED;
+    }
+
+    // Replaces the sidecar of `path` with one for its current contents
+    static bool restamp(const string &path)
+    {
+        ifstream file(path, ios::binary);
+        stringstream contents;
+        contents << file.rdbuf();
+        struct stat st;
+        if (!file.good() || ::stat(path.c_str(), &st) != 0)
+            return false;
+        string sidecar = sidecarPath(path);
+        string temp = sidecar + ".tmp";
+        {
+            ofstream out(temp, ios::binary | ios::trunc);
+            out << sidecarFor(contents.str(), static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec);
+            if (!out.good())
+                return false;
+        }
+        return ::rename(temp.c_str(), sidecar.c_str()) == 0;
+    }
+};
+
+#if defined(HAVE_IO_URING)
+// Minimal io_uring submission/completion ring driven through the raw
+// syscalls, so no liburing is needed. Owned by one thread.
+class IoUring
+{
+public:
+    struct Completion
+    {
+        uint64_t userData;
+        int32_t result;
+    };
+
+private:
+    int fd = -1;
+    unsigned entries = 0;
+    void *sqRing = MAP_FAILED;
+    size_t sqRingSize = 0;
+    void *cqRing = MAP_FAILED;
+    size_t cqRingSize = 0;
+    io_uring_sqe *sqes = nullptr;
+    size_t sqesSize = 0;
+    unsigned *sqTail = nullptr;
+    unsigned *sqMask = nullptr;
+    unsigned *sqArray = nullptr;
+    unsigned *cqHead = nullptr;
+    unsigned *cqTail = nullptr;
+    unsigned *cqMask = nullptr;
+    io_uring_cqe *cqes = nullptr;
+    unsigned queued = 0;   // filled but not yet submitted
+    unsigned inFlight = 0; // taken by the kernel when a submission failed, not yet completed
+
+    template <typename T>
+    static T *at(void *base, uint32_t offset)
+    {
+        return reinterpret_cast<T *>(static_cast<char *>(base) + offset);
+    }
+
+public:
+    IoUring() = default;
+    IoUring(const IoUring &) = delete;
+    IoUring &operator=(const IoUring &) = delete;
+
+    ~IoUring()
+    {
+        close();
+    }
+
+    // Sets up a ring of `depth` entries; false if the kernel lacks io_uring,
+    // forbids it, or does not support every opcode in `ops`
+    bool open(unsigned depth, initializer_list<uint8_t> ops)
+    {
+        io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        fd = static_cast<int>(::syscall(__NR_io_uring_setup, depth, &params));
+        if (fd < 0)
+            return false;
+
+        auto probe = static_cast<io_uring_probe *>(calloc(1, sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op)));
+        bool supported = probe && ::syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, 256) >= 0;
+        for (uint8_t op : ops)
+            supported = supported && op <= probe->last_op && (probe->ops[op].flags & IO_URING_OP_SUPPORTED);
+        free(probe);
+        if (!supported)
+        {
+            close();
+            return false;
+        }
+
+        entries = params.sq_entries;
+        sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (single)
+            sqRingSize = cqRingSize = max(sqRingSize, cqRingSize);
+
+        sqRing = ::mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+        cqRing = single ? sqRing : ::mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+        void *sqeMap = ::mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+        if (sqRing == MAP_FAILED || cqRing == MAP_FAILED || sqeMap == MAP_FAILED)
+        {
+            if (sqeMap != MAP_FAILED)
+                ::munmap(sqeMap, sqesSize);
+            close();
+            return false;
+        }
+        sqes = static_cast<io_uring_sqe *>(sqeMap);
+
+        sqTail = at<unsigned>(sqRing, params.sq_off.tail);
+        sqMask = at<unsigned>(sqRing, params.sq_off.ring_mask);
+        sqArray = at<unsigned>(sqRing, params.sq_off.array);
+        cqHead = at<unsigned>(cqRing, params.cq_off.head);
+        cqTail = at<unsigned>(cqRing, params.cq_off.tail);
+        cqMask = at<unsigned>(cqRing, params.cq_off.ring_mask);
+        cqes = at<io_uring_cqe>(cqRing, params.cq_off.cqes);
+        return true;
+    }
+
+    void close()
+    {
+        if (sqes)
+            ::munmap(sqes, sqesSize);
+        if (cqRing != MAP_FAILED && cqRing != sqRing)
+            ::munmap(cqRing, cqRingSize);
+        if (sqRing != MAP_FAILED)
+            ::munmap(sqRing, sqRingSize);
+        if (fd >= 0)
+            ::close(fd);
+        fd = -1;
+        sqes = nullptr;
+        sqRing = cqRing = MAP_FAILED;
+        entries = queued = 0;
+    }
+
+    bool isOpen() const { return fd >= 0; }
+    unsigned capacity() const { return entries; }
+    unsigned pending() const { return queued; }
+
+    // Next free submission entry, zeroed; null once `capacity()` are queued
+    io_uring_sqe *next(uint8_t opcode, uint64_t userData)
+    {
+        if (queued == entries)
+            return nullptr;
+        unsigned index = (*sqTail + queued) & *sqMask;
+        io_uring_sqe *sqe = &sqes[index];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = opcode;
+        sqe->user_data = userData;
+        sqArray[index] = index;
+        ++queued;
+        return sqe;
+    }
+
+    // Submits everything queued in one go and waits until each entry has
+    // completed. Linked entries cancelled by an earlier failure still report
+    // a completion (-ECANCELED).
+    bool submitAndWait(vector<Completion> &completions)
+    {
+        unsigned total = queued;
+        __atomic_store_n(sqTail, *sqTail + queued, __ATOMIC_RELEASE);
+        queued = 0;
+
+        unsigned unsubmitted = total;
+        unsigned reaped = 0;
+        while (reaped < total)
+        {
+            long rc = ::syscall(__NR_io_uring_enter, fd, unsubmitted, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+            if (rc < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY)
+            {
+                inFlight = total - unsubmitted - reaped;
+                return false;
+            }
+            if (rc > 0)
+                unsubmitted -= min(static_cast<unsigned>(rc), unsubmitted);
+
+            unsigned head = *cqHead;
+            unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+            for (; head != tail; ++head, ++reaped)
+            {
+                const io_uring_cqe &cqe = cqes[head & *cqMask];
+                completions.push_back({cqe.user_data, cqe.res});
+            }
+            __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+        }
+        return true;
+    }
+
+    // Waits out the requests the kernel took before submitAndWait failed, so
+    // nothing still touches their files; false if that cannot be confirmed
+    bool drain()
+    {
+        while (inFlight > 0)
+        {
+            long rc = ::syscall(__NR_io_uring_enter, fd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+            if (rc < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY)
+                return false;
+            unsigned head = *cqHead;
+            unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+            for (; head != tail && inFlight > 0; ++head)
+                --inFlight;
+            __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+        }
+        return true;
+    }
+};
+#endif
+
+// Outcome of a background save
+struct PersistResult
+{
+    bool ok;
+    string path;
+    string error;
+};
+
+// Single background thread that persists files crash-safely. Callers hand
+// over a serializer owning a consistent copy of their data; the worker runs it,
+// writes the result to a temp file, fsyncs it and renames it over the target,
+// so a crash leaves either the old or the new file, never a torn one. Jobs
+// queued together are committed together by BatchFileWriter.
+class PersistenceWorker
+{
+private:
+    struct Job
+    {
+        string path;
+        function<string()> serialize;
+        function<void()> afterCommit;
+        promise<PersistResult> done;
+    };
+
+    mutex lock;
+    condition_variable wake;
+    deque<Job> jobs;
+    deque<Job> heldJobs; // submitted while a Batch is open
+    unsigned holds;
+    bool stopping;
+    thread worker;
+
+    PersistenceWorker() : holds(0), stopping(false)
+    {
+        worker = thread([this]()
+                        { run(); });
+    }
+
+    // Takes every queued job and writes their files as one batch
+    void run();
+
+    void hold()
+    {
+        lock_guard<mutex> guard(lock);
+        ++holds;
+    }
+
+    void release()
+    {
+        {
+            lock_guard<mutex> guard(lock);
+            if (--holds > 0)
+                return;
+            move(heldJobs.begin(), heldJobs.end(), back_inserter(jobs));
+            heldJobs.clear();
+        }
+        wake.notify_one();
+    }
+
+public:
+    PersistenceWorker(const PersistenceWorker &) = delete;
+    PersistenceWorker &operator=(const PersistenceWorker &) = delete;
+
+    // Drains every queued save before the process exits
+    ~PersistenceWorker()
+    {
+        {
+            lock_guard<mutex> guard(lock);
+            stopping = true;
+        }
+        wake.notify_one();
+        worker.join();
+    }
+
+    static PersistenceWorker &instance()
+    {
+        static PersistenceWorker persistenceWorker;
+        return persistenceWorker;
+    }
+
+    // Saves submitted while a Batch is alive are held back and handed to the
+    // worker together when it ends, so they are committed in one round trip
+    class Batch
+    {
+    public:
+        Batch() { instance().hold(); }
+        ~Batch() { instance().release(); }
+        Batch(const Batch &) = delete;
+        Batch &operator=(const Batch &) = delete;
+    };
+
+    // Queues a save of `path`. `serialize` runs on the worker thread and must only
+    // touch data it owns; `afterCommit` runs there once the new file is in place.
+    future<PersistResult> submit(const string &path, function<string()> serialize, function<void()> afterCommit = nullptr)
+    {
+        Job job{path, move(serialize), move(afterCommit), {}};
+        future<PersistResult> result = job.done.get_future();
+        {
+            lock_guard<mutex> guard(lock);
+            (holds ? heldJobs : jobs).push_back(move(job));
+        }
+        wake.notify_one();
+        return result;
+    }
+
+    // Writes and fsyncs a whole file, giving it modification time `mtimeNs`
+    // unless that is negative; false with errno set on failure
+    static bool writeDurably(const string &path, const string &contents, int64_t mtimeNs = -1)
+    {
+        int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0)
+            return false;
+
+        size_t written = 0;
+        while (written < contents.size())
+        {
+            ssize_t n = ::write(fd, contents.data() + written, contents.size() - written);
+            if (n < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                int error = errno;
+                ::close(fd);
+                errno = error;
+                return false;
+            }
+            written += static_cast<size_t>(n);
+        }
+
+        if ((mtimeNs >= 0 && !DataIntegrity::stampFile(fd, mtimeNs)) || ::fsync(fd) != 0)
+        {
+            int error = errno;
+            ::close(fd);
+            errno = error;
+            return false;
+        }
+        return ::close(fd) == 0;
+    }
+
+    // temp file + checksum -> fsync -> previous file to .bak -> rename -> fsync
+    // directory. The old sidecar is removed before the rename, so a crash in
+    // between leaves an unchecked file rather than a false checksum failure.
+    static PersistResult writeAtomically(const string &path, const string &contents, bool keepBackup = true)
+    {
+        auto failure = [&](const string &step)
+        {
+            return PersistResult{false, path, step + ": " + strerror(errno)};
+        };
+
+        string tempPath = path + ".tmp";
+        string sidecar = DataIntegrity::sidecarPath(path);
+        string sidecarTemp = sidecar + ".tmp";
+        int64_t stamp = DataIntegrity::newStamp();
+        if (!writeDurably(tempPath, contents, stamp))
+            return failure("Unable to write " + tempPath);
+        if (!writeDurably(sidecarTemp, DataIntegrity::sidecarFor(contents, stamp)))
+            return failure("Unable to write " + sidecarTemp);
+
+        // Keep the previous version as the last good copy, unless it is itself corrupt
+        DataIntegrity::Status previous = DataIntegrity::verify(path);
+        if (keepBackup && (previous == DataIntegrity::Status::VERIFIED || previous == DataIntegrity::Status::UNCHECKED ||
+                           previous == DataIntegrity::Status::EDITED))
+        {
+            string backup = DataIntegrity::backupPath(path);
+            ::remove(DataIntegrity::sidecarPath(backup).c_str());
+            if (::rename(path.c_str(), backup.c_str()) == 0)
+                ::rename(sidecar.c_str(), DataIntegrity::sidecarPath(backup).c_str());
+        }
+        ::remove(sidecar.c_str());
+
+        if (::rename(tempPath.c_str(), path.c_str()) != 0)
+            return failure("Unable to replace " + path);
+        if (::rename(sidecarTemp.c_str(), sidecar.c_str()) != 0)
+            return failure("Unable to replace " + sidecar);
+
+        // Make the rename itself durable
+        syncDirectoryOf(path);
+        return PersistResult{true, path, ""};
+    }
+
+    // Makes the directory entries of the directory holding `path` durable
+    static void syncDirectoryOf(const string &path)
+    {
+        size_t slash = path.find_last_of('/');
+        string directory = slash == string::npos ? "." : path.substr(0, slash + 1);
+        int dirFd = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY);
+        if (dirFd >= 0)
+        {
+            ::fsync(dirFd);
+            ::close(dirFd);
+        }
+    }
+
+    // Appends to a file and fdatasyncs it, so the bytes survive a crash once
+    // this returns; `size` gets the new file size. False with errno set on failure.
+    static bool appendDurably(const string &path, const string &contents, uint64_t &size)
+    {
+        struct stat st;
+        bool created = ::stat(path.c_str(), &st) != 0;
+        int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (fd < 0)
+            return false;
+
+        size_t written = 0;
+        while (written < contents.size())
+        {
+            ssize_t n = ::write(fd, contents.data() + written, contents.size() - written);
+            if (n < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                int error = errno;
+                ::close(fd);
+                errno = error;
+                return false;
+            }
+            written += static_cast<size_t>(n);
+        }
+
+        if (::fdatasync(fd) != 0 || ::fstat(fd, &st) != 0)
+        {
+            int error = errno;
+            ::close(fd);
+            errno = error;
+            return false;
+        }
+        size = static_cast<uint64_t>(st.st_size);
+        if (created)
+            syncDirectoryOf(path);
+        return ::close(fd) == 0;
+    }
+};
+
+// One file of a batch commit
+struct FileWrite
+{
+    string path;
+    string contents;
+};
+
+// Commits several files with the same steps and crash-safety as
+// PersistenceWorker::writeAtomically. With io_uring each file's writes,
+// fsyncs, backup rotation and renames form one linked chain, the chains of all
+// files go to the kernel in a single submission, and the directory fsyncs
+// follow in a second one. Without io_uring the files are written on a thread
+// each. A file whose chain fails is retried with writeAtomically.
+class BatchFileWriter
+{
+private:
+#if defined(HAVE_IO_URING)
+    static constexpr unsigned RING_DEPTH = 128;
+    static constexpr size_t MAX_WRITE = size_t(1) << 30; // per write request
+
+    // Everything the kernel reads for one file has to outlive the submission
+    struct Chain
+    {
+        const FileWrite *file;
+        int64_t stamp = 0; // modification time the sidecar records
+        string sidecarContents;
+        string tempPath, sidecar, sidecarTemp, backup, backupSidecar;
+        int dataFd = -1;
+        int sidecarFd = -1;
+        vector<pair<string, int32_t>> steps; // failure message, expected result
+        io_uring_sqe *last = nullptr;
+        string error;
+        bool retry = true; // false while its requests may still be running
+    };
+
+    IoUring ring;
+    bool ringTried = false;
+
+    static bool exists(const string &path)
+    {
+        struct stat st;
+        return ::stat(path.c_str(), &st) == 0;
+    }
+
+    static string directoryOf(const string &path)
+    {
+        size_t slash = path.find_last_of('/');
+        return slash == string::npos ? "." : path.substr(0, slash + 1);
+    }
+
+    // Queues one step of `chain`, linked to the step after it
+    io_uring_sqe *queue(Chain &chain, size_t index, uint8_t opcode, const string &what, int32_t expected)
+    {
+        uint64_t userData = (static_cast<uint64_t>(index) << 32) | chain.steps.size();
+        chain.steps.push_back({what, expected});
+        io_uring_sqe *sqe = ring.next(opcode, userData);
+        sqe->flags = IOSQE_IO_LINK;
+        chain.last = sqe;
+        return sqe;
+    }
+
+    void queueWrite(Chain &chain, size_t index, int fd, const string &contents, const string &path)
+    {
+        for (size_t offset = 0; offset < contents.size(); offset += MAX_WRITE)
+        {
+            size_t length = min(MAX_WRITE, contents.size() - offset);
+            io_uring_sqe *sqe = queue(chain, index, IORING_OP_WRITE, "Unable to write " + path, static_cast<int32_t>(length));
+            sqe->fd = fd;
+            sqe->addr = reinterpret_cast<uint64_t>(contents.data() + offset);
+            sqe->len = static_cast<uint32_t>(length);
+            sqe->off = offset;
+        }
+        queue(chain, index, IORING_OP_FSYNC, "Unable to write " + path, 0)->fd = fd;
+    }
+
+    void queueRename(Chain &chain, size_t index, const string &from, const string &to, const string &what)
+    {
+        io_uring_sqe *sqe = queue(chain, index, IORING_OP_RENAMEAT, what, 0);
+        sqe->fd = AT_FDCWD;
+        sqe->addr = reinterpret_cast<uint64_t>(from.c_str());
+        sqe->len = static_cast<uint32_t>(AT_FDCWD);
+        sqe->addr2 = reinterpret_cast<uint64_t>(to.c_str());
+    }
+
+    void queueUnlink(Chain &chain, size_t index, const string &path)
+    {
+        io_uring_sqe *sqe = queue(chain, index, IORING_OP_UNLINKAT, "Unable to remove " + path, 0);
+        sqe->fd = AT_FDCWD;
+        sqe->addr = reinterpret_cast<uint64_t>(path.c_str());
+    }
+
+    // Ring entries a file needs at most: data writes, sidecar write, two
+    // fsyncs, three rotation steps and two renames
+    static size_t stepsFor(const FileWrite &file)
+    {
+        return (file.contents.size() + MAX_WRITE - 1) / MAX_WRITE + 8;
+    }
+
+    // Opens the temp files and decides the rotation up front, then queues
+    // the chain; false if it could not be started
+    bool prepare(Chain &chain, size_t index)
+    {
+        const string &path = chain.file->path;
+        chain.stamp = DataIntegrity::newStamp();
+        chain.sidecarContents = DataIntegrity::sidecarFor(chain.file->contents, chain.stamp);
+        chain.tempPath = path + ".tmp";
+        chain.sidecar = DataIntegrity::sidecarPath(path);
+        chain.sidecarTemp = chain.sidecar + ".tmp";
+        chain.backup = DataIntegrity::backupPath(path);
+        chain.backupSidecar = DataIntegrity::sidecarPath(chain.backup);
+
+        chain.dataFd = ::open(chain.tempPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        chain.sidecarFd = ::open(chain.sidecarTemp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (chain.dataFd < 0 || chain.sidecarFd < 0)
+            return false;
+
+        queueWrite(chain, index, chain.dataFd, chain.file->contents, chain.tempPath);
+        queueWrite(chain, index, chain.sidecarFd, chain.sidecarContents, chain.sidecarTemp);
+
+        // Keep the previous version as the last good copy, unless it is itself corrupt
+        DataIntegrity::Status previous = DataIntegrity::verify(path);
+        if (previous == DataIntegrity::Status::VERIFIED || previous == DataIntegrity::Status::UNCHECKED ||
+            previous == DataIntegrity::Status::EDITED)
+        {
+            if (exists(chain.backupSidecar))
+                queueUnlink(chain, index, chain.backupSidecar);
+            queueRename(chain, index, path, chain.backup, "Unable to back up " + path);
+            if (exists(chain.sidecar))
+                queueRename(chain, index, chain.sidecar, chain.backupSidecar, "Unable to back up " + chain.sidecar);
+        }
+        else if (exists(chain.sidecar))
+        {
+            queueUnlink(chain, index, chain.sidecar);
+        }
+        queueRename(chain, index, chain.tempPath, path, "Unable to replace " + path);
+        queueRename(chain, index, chain.sidecarTemp, chain.sidecar, "Unable to replace " + chain.sidecar);
+        chain.last->flags = 0; // ends the chain
+        return true;
+    }
+
+    // Commits files[first, last) through the ring; failed files keep an error
+    void commitChains(vector<Chain> &chains, size_t first, size_t last)
+    {
+        if (!ring.pending())
+            return;
+        vector<IoUring::Completion> completions;
+        if (!ring.submitAndWait(completions))
+        {
+            // The thread fallback reuses the temp paths, so it may only run
+            // once no submitted request can still rename or write them
+            bool drained = ring.drain();
+            for (size_t i = first; i < last; ++i)
+            {
+                chains[i].error = "io_uring submission failed";
+                chains[i].retry = drained;
+            }
+            ring.close();
+            return;
+        }
+
+        for (const auto &completion : completions)
+        {
+            Chain &chain = chains[completion.userData >> 32];
+            const auto &[what, expected] = chain.steps[completion.userData & 0xffffffffu];
+            if (completion.result == expected || !chain.error.empty())
+                continue;
+            int error = completion.result < 0 ? -completion.result : EIO;
+            chain.error = what + ": " + strerror(error);
+        }
+
+        // Give each file the time its sidecar records (the writes set their own),
+        // then make that and the renames durable, once per directory
+        set<string> directories;
+        for (size_t i = first; i < last; ++i)
+        {
+            if (!chains[i].error.empty())
+                continue;
+            if (!DataIntegrity::stampFile(chains[i].dataFd, chains[i].stamp))
+                chains[i].error = "Unable to set the modification time of " + chains[i].file->path + ": " + strerror(errno);
+            else if (io_uring_sqe *sqe = ring.next(IORING_OP_FSYNC, 0))
+                sqe->fd = chains[i].dataFd;
+            else
+                ::fsync(chains[i].dataFd);
+            directories.insert(directoryOf(chains[i].file->path));
+        }
+        vector<int> directoryFds;
+        for (const string &directory : directories)
+        {
+            int dirFd = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            if (dirFd < 0)
+                continue;
+            directoryFds.push_back(dirFd);
+            if (io_uring_sqe *sqe = ring.next(IORING_OP_FSYNC, 0))
+                sqe->fd = dirFd;
+            else
+                ::fsync(dirFd);
+        }
+        completions.clear();
+        if (ring.pending() && !ring.submitAndWait(completions))
+            ring.close();
+        for (int dirFd : directoryFds)
+            ::close(dirFd);
+    }
+
+    bool commitWithRing(const vector<FileWrite> &files, vector<PersistResult> &results)
+    {
+        if (!ringTried)
+        {
+            ringTried = true;
+            ring.open(RING_DEPTH, {IORING_OP_WRITE, IORING_OP_FSYNC, IORING_OP_RENAMEAT, IORING_OP_UNLINKAT});
+        }
+        if (!ring.isOpen())
+            return false;
+
+        vector<Chain> chains(files.size());
+        size_t first = 0;
+        for (size_t i = 0; i < files.size(); ++i)
+        {
+            chains[i].file = &files[i];
+            size_t needed = stepsFor(files[i]);
+            if (needed > ring.capacity() - ring.pending())
+            {
+                // Chains cannot span submissions, so commit what is queued first
+                commitChains(chains, first, i);
+                first = i;
+            }
+            if (!ring.isOpen() || needed > ring.capacity() || !prepare(chains[i], i))
+                chains[i].error = "not queued";
+        }
+        if (ring.isOpen())
+            commitChains(chains, first, files.size());
+
+        for (auto &chain : chains)
+        {
+            if (chain.dataFd >= 0)
+                ::close(chain.dataFd);
+            if (chain.sidecarFd >= 0)
+                ::close(chain.sidecarFd);
+            if (chain.error.empty())
+                results.push_back({true, chain.file->path, ""});
+            else if (!chain.retry)
+                results.push_back({false, chain.file->path, chain.error + " with requests still in flight"});
+            else
+                results.push_back(PersistenceWorker::writeAtomically(chain.file->path, chain.file->contents));
+        }
+        return true;
+    }
+#endif
+
+    static vector<PersistResult> commitOnThreads(const vector<FileWrite> &files)
+    {
+        vector<PersistResult> results(files.size());
+        vector<thread> writers;
+        for (size_t i = 1; i < files.size(); ++i)
+        {
+            writers.emplace_back([&files, &results, i]()
+                                 { results[i] = PersistenceWorker::writeAtomically(files[i].path, files[i].contents); });
+        }
+        if (!files.empty())
+            results[0] = PersistenceWorker::writeAtomically(files[0].path, files[0].contents);
+        for (auto &writer : writers)
+            writer.join();
+        return results;
+    }
+
+public:
+    vector<PersistResult> commit(const vector<FileWrite> &files)
+    {
+#if defined(HAVE_IO_URING)
+        vector<PersistResult> results;
+        if (commitWithRing(files, results))
+            return results;
+#endif
+        return commitOnThreads(files);
+    }
+};
+
+inline void PersistenceWorker::run()
+{
+    BatchFileWriter writer;
+    while (true)
+    {
+        vector<Job> batch;
+        {
+            unique_lock<mutex> guard(lock);
+            wake.wait(guard, [this]()
+                      { return stopping || !jobs.empty(); });
+            if (jobs.empty())
+                return;
+            // A second save of the same file waits for the next batch
+            set<string> paths;
+            while (!jobs.empty() && paths.insert(jobs.front().path).second)
+            {
+                batch.push_back(move(jobs.front()));
+                jobs.pop_front();
+            }
+        }
+
+        vector<PersistResult> results;
+        vector<FileWrite> files;
+        vector<size_t> owners;
+        for (size_t i = 0; i < batch.size(); ++i)
+        {
+            results.push_back({false, batch[i].path, ""});
+            try
+            {
+                files.push_back({batch[i].path, batch[i].serialize()});
+                owners.push_back(i);
+            }
+            catch (const exception &e)
+            {
+                results[i].error = e.what();
+            }
+        }
+
+        vector<PersistResult> written = writer.commit(files);
+        for (size_t k = 0; k < owners.size(); ++k)
+            results[owners[k]] = written[k];
+
+        for (size_t i = 0; i < batch.size(); ++i)
+        {
+            try
+            {
+                if (results[i].ok && batch[i].afterCommit)
+                    batch[i].afterCommit();
+            }
+            catch (const exception &e)
+            {
+                results[i].error = e.what();
+            }
+            batch[i].done.set_value(results[i]);
+        }
+    }
+}
+
+inline bool DataIntegrity::writeRestored(const string &path, const string &contents)
+{
+    return PersistenceWorker::writeAtomically(path, contents, false).ok;
+}
+
+// Binary snapshot of the food catalog, derived from food_database.json.
+//
+// Layout (native byte order): Header, food records, keyword string refs,
+// component edges, nutrient rows, string table. Component edges reference foods by name
+// (interned in the string table), so unresolved composites round-trip exactly
+// and loading yields the same basic foods + pending composites as the JSON
+// parsers. The header records the size and mtime of the JSON file it was
+// built from; a mismatch means the snapshot is stale.
+class CatalogSnapshot
+{
+public:
+    // Version 3: records are sorted by name so the file can be searched in place
+    // Version 4: the header carries a CRC32C of everything after it
+    // Version 5: basic foods may point at a row of the nutrient table
+    // Version 6: the header names the nutrient schema the rows were written with
+    // Version 7: basic foods carry the nutrients the schema does not track
+    // Version 8: composite records carry their calorie totals
+    static constexpr uint32_t VERSION = 8;
+
+private:
+    static constexpr char MAGIC[8] = {'D', 'M', 'S', 'N', 'A', 'P', '\0', '\0'};
+
+    enum : uint32_t
+    {
+        TYPE_BASIC = 0,
+        TYPE_COMPOSITE = 1
+    };
+
+    struct StringRef
+    {
+        uint32_t offset;
+        uint32_t length;
+    };
+
+    struct Header
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t foodCount;
+        uint32_t keywordCount;
+        uint32_t componentCount;
+        uint64_t stringTableSize;
+        uint64_t sourceSize;
+        int64_t sourceMtimeNs;
+        uint32_t payloadCrc;
+        uint32_t nutrientRowCount;
+        uint32_t nutrientSchema;
+        uint32_t reserved;
+    };
+
+    struct FoodRecord
+    {
+        StringRef name;
+        uint32_t firstKeyword;
+        uint32_t keywordCount;
+        uint32_t firstComponent;
+        uint32_t componentCount;
+        float calories;
+        uint32_t type;
+        uint32_t nutrientRow; // NO_NUTRIENTS unless a nutrient besides calories is set
+        StringRef untracked;  // compact JSON object of untracked nutrients, empty if none
+    };
+
+    static constexpr uint32_t NO_NUTRIENTS = numeric_limits<uint32_t>::max();
+
+    struct ComponentRecord
+    {
+        StringRef name;
+        float servings;
+    };
+
+    // Accumulates the sections of a snapshot while foods are added
+    struct Builder
+    {
+        vector<FoodRecord> records;
+        vector<StringRef> keywords;
+        vector<ComponentRecord> components;
+        vector<NutrientVector> nutrientRows;
+        string strings;
+        unordered_map<string, StringRef> interned;
+
+        StringRef intern(const string &text)
+        {
+            auto it = interned.find(text);
+            if (it != interned.end())
+                return it->second;
+            StringRef ref{static_cast<uint32_t>(strings.size()), static_cast<uint32_t>(text.size())};
+            strings += text;
+            interned.emplace(text, ref);
+            return ref;
+        }
+
+        FoodRecord &add(const string &name, const vector<string> &foodKeywords, uint32_t type)
+        {
+            FoodRecord record{};
+            record.name = intern(name);
+            record.type = type;
+            record.nutrientRow = NO_NUTRIENTS;
+            record.firstKeyword = static_cast<uint32_t>(keywords.size());
+            record.keywordCount = static_cast<uint32_t>(foodKeywords.size());
+            for (const auto &keyword : foodKeywords)
+                keywords.push_back(intern(keyword));
+            record.firstComponent = static_cast<uint32_t>(components.size());
+            records.push_back(record);
+            return records.back();
+        }
+
+        void addComponent(FoodRecord &record, const string &name, float servings)
+        {
+            components.push_back({intern(name), servings});
+            ++record.componentCount;
+        }
+    };
+
+    static string encodeUntracked(const UntrackedNutrients &untracked)
+    {
+        JsonStreamWriter writer(-1, 64);
+        writer.beginObject();
+        for (const auto &[name, value] : untracked)
+            writer.key(name).value(value);
+        writer.endObject();
+        return writer.take();
+    }
+
+    // Total calories of a pending composite, from the foods it names; names in
+    // neither map are priced by `external`. NaN when a name is missing or the
+    // composite contains itself, as such a food is never built.
+    static float pendingCalories(const string &name, const map<string, shared_ptr<Food>> &foods,
+                                 const map<string, PendingComposite> &pending,
+                                 const function<bool(const string &, float &)> &external,
+                                 unordered_map<string, float> &priced)
+    {
+        auto known = priced.find(name);
+        if (known != priced.end())
+            return known->second;
+        // Marked before recursing, so a cycle reads NaN
+        priced[name] = numeric_limits<float>::quiet_NaN();
+
+        float total = 0.0f;
+        for (const auto &component : pending.at(name).components)
+        {
+            float calories = numeric_limits<float>::quiet_NaN();
+            auto food = foods.find(component.name);
+            if (food != foods.end())
+                calories = food->second->getCalories();
+            else if (pending.count(component.name))
+                calories = pendingCalories(component.name, foods, pending, external, priced);
+            else if (!external || !external(component.name, calories))
+                calories = numeric_limits<float>::quiet_NaN();
+            total += calories * component.servings;
+        }
+        priced[name] = total;
+        return total;
+    }
+
+public:
+    // `external` gives the calories of component names found in neither map
+    static bool write(const string &path, const map<string, shared_ptr<Food>> &foods,
+                      const map<string, PendingComposite> &pending, const FileStamp &source,
+                      const function<bool(const string &, float &)> &external)
+    {
+        Builder builder;
+        unordered_map<string, float> priced;
+        builder.records.reserve(foods.size() + pending.size());
+
+        // Merge both maps into one name-ordered run; built foods win over pending ones
+        auto food = foods.begin();
+        auto composite = pending.begin();
+        while (food != foods.end() || composite != pending.end())
+        {
+            if (composite == pending.end() || (food != foods.end() && food->first <= composite->first))
+            {
+                if (composite != pending.end() && composite->first == food->first)
+                    ++composite;
+                if (const auto *built = dynamic_cast<const CompositeFood *>(food->second.get()))
+                {
+                    FoodRecord &record = builder.add(food->first, built->getKeywords(), TYPE_COMPOSITE);
+                    record.calories = built->getCalories();
+                    for (const auto &component : built->getComponents())
+                        builder.addComponent(record, component.food->getName(), component.servings);
+                }
+                else
+                {
+                    FoodRecord &record = builder.add(food->first, food->second->getKeywords(), TYPE_BASIC);
+                    const auto *basic = dynamic_cast<const BasicFood *>(food->second.get());
+                    if (basic && !basic->getUntrackedNutrients().empty())
+                        record.untracked = builder.intern(encodeUntracked(basic->getUntrackedNutrients()));
+                    NutrientVector nutrients = food->second->getNutrients();
+                    record.calories = nutrients[NutrientVector::CALORIES];
+                    if (nutrients.hasDetails())
+                    {
+                        nutrients[NutrientVector::CALORIES] = 0.0f;
+                        record.nutrientRow = static_cast<uint32_t>(builder.nutrientRows.size());
+                        builder.nutrientRows.push_back(nutrients);
+                    }
+                }
+                ++food;
+            }
+            else
+            {
+                FoodRecord &record = builder.add(composite->first, composite->second.keywords, TYPE_COMPOSITE);
+                record.calories = pendingCalories(composite->first, foods, pending, external, priced);
+                for (const auto &component : composite->second.components)
+                    builder.addComponent(record, component.name, component.servings);
+                ++composite;
+            }
+        }
+
+        Header header{};
+        memcpy(header.magic, MAGIC, sizeof(MAGIC));
+        header.version = VERSION;
+        header.foodCount = static_cast<uint32_t>(builder.records.size());
+        header.keywordCount = static_cast<uint32_t>(builder.keywords.size());
+        header.componentCount = static_cast<uint32_t>(builder.components.size());
+        header.nutrientRowCount = static_cast<uint32_t>(builder.nutrientRows.size());
+        header.nutrientSchema = nutrient::Tracked::ID;
+        header.stringTableSize = builder.strings.size();
+        header.sourceSize = source.size;
+        header.sourceMtimeNs = source.mtimeNs;
+
+        const char *sections[] = {reinterpret_cast<const char *>(builder.records.data()),
+                                  reinterpret_cast<const char *>(builder.keywords.data()),
+                                  reinterpret_cast<const char *>(builder.components.data()),
+                                  reinterpret_cast<const char *>(builder.nutrientRows.data()), builder.strings.data()};
+        size_t sectionSizes[] = {builder.records.size() * sizeof(FoodRecord), builder.keywords.size() * sizeof(StringRef),
+                                 builder.components.size() * sizeof(ComponentRecord),
+                                 builder.nutrientRows.size() * sizeof(NutrientVector), builder.strings.size()};
+        for (size_t i = 0; i < 5; ++i)
+            header.payloadCrc = Crc32c::extend(header.payloadCrc, sections[i], sectionSizes[i]);
+
+        // Write to a per-process temporary file and rename, so readers (including
+        // other processes attached to the old image) never see a partial snapshot
+        string tempPath = path + ".tmp." + to_string(::getpid());
+        {
+            ofstream file(tempPath, ios::binary | ios::trunc);
+            if (!file.is_open())
+                return false;
+            file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+            for (size_t i = 0; i < 5; ++i)
+                file.write(sections[i], sectionSizes[i]);
+            if (!file.good())
+            {
+                file.close();
+                ::remove(tempPath.c_str());
+                return false;
+            }
+        }
+        if (::rename(tempPath.c_str(), path.c_str()) != 0)
+        {
+            ::remove(tempPath.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    // Read-only view of a snapshot mapped into memory. Pages of the mapping are
+    // shared by every process attached to the same file, and records are read
+    // in place: nothing is copied until a food is asked for.
+    class View
+    {
+    private:
+        MappedFile mapped;
+        Header header{};
+        const char *records = nullptr;
+        const char *keywordRefs = nullptr;
+        const char *componentRecords = nullptr;
+        const char *nutrientRows = nullptr;
+        const char *strings = nullptr;
+
+        template <typename T>
+        static T read(const char *section, size_t index)
+        {
+            T value;
+            memcpy(&value, section + index * sizeof(T), sizeof(T));
+            return value;
+        }
+
+        FoodRecord record(size_t index) const { return read<FoodRecord>(records, index); }
+
+        bool valid(const StringRef &ref) const
+        {
+            return uint64_t(ref.offset) + ref.length <= header.stringTableSize;
+        }
+
+        string_view text(const StringRef &ref) const
+        {
+            return string_view(strings + ref.offset, ref.length);
+        }
+
+    public:
+        static constexpr size_t npos = numeric_limits<size_t>::max();
+
+        // Maps the snapshot at `path` if it was built from `source` and is well formed
+        bool attach(const string &path, const FileStamp &source)
+        {
+            if (!mapped.map(path) || mapped.size() < sizeof(Header))
+                return false;
+
+            memcpy(&header, mapped.begin(), sizeof(header));
+            if (memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 || header.version != VERSION ||
+                header.nutrientSchema != nutrient::Tracked::ID ||
+                header.sourceSize != source.size || header.sourceMtimeNs != source.mtimeNs)
+                return false;
+
+            uint64_t recordsOffset = sizeof(Header);
+            uint64_t keywordsOffset = recordsOffset + uint64_t(header.foodCount) * sizeof(FoodRecord);
+            uint64_t componentsOffset = keywordsOffset + uint64_t(header.keywordCount) * sizeof(StringRef);
+            uint64_t nutrientsOffset = componentsOffset + uint64_t(header.componentCount) * sizeof(ComponentRecord);
+            uint64_t stringsOffset = nutrientsOffset + uint64_t(header.nutrientRowCount) * sizeof(NutrientVector);
+            if (stringsOffset + header.stringTableSize != mapped.size())
+                return false;
+
+            const char *base = mapped.begin();
+            if (Crc32c::compute(base + sizeof(Header), mapped.size() - sizeof(Header)) != header.payloadCrc)
+                return false;
+            records = base + recordsOffset;
+            keywordRefs = base + keywordsOffset;
+            componentRecords = base + componentsOffset;
+            nutrientRows = base + nutrientsOffset;
+            strings = base + stringsOffset;
+
+            // Validate every reference once, so lookups need no bounds checks
+            for (uint32_t k = 0; k < header.keywordCount; ++k)
+            {
+                if (!valid(read<StringRef>(keywordRefs, k)))
+                    return false;
+            }
+            for (uint32_t c = 0; c < header.componentCount; ++c)
+            {
+                if (!valid(read<ComponentRecord>(componentRecords, c).name))
+                    return false;
+            }
+            string_view previous;
+            for (uint32_t i = 0; i < header.foodCount; ++i)
+            {
+                FoodRecord food = record(i);
+                if (!valid(food.name) || !valid(food.untracked) || (food.type != TYPE_BASIC && food.type != TYPE_COMPOSITE) ||
+                    uint64_t(food.firstKeyword) + food.keywordCount > header.keywordCount ||
+                    uint64_t(food.firstComponent) + food.componentCount > header.componentCount ||
+                    (food.nutrientRow != NO_NUTRIENTS && food.nutrientRow >= header.nutrientRowCount))
+                    return false;
+                string_view name = text(food.name);
+                if (i > 0 && !(previous < name))
+                    return false;
+                previous = name;
+            }
+            return true;
+        }
+
+        size_t size() const { return header.foodCount; }
+        string_view name(size_t index) const { return text(record(index).name); }
+        bool isComposite(size_t index) const { return record(index).type == TYPE_COMPOSITE; }
+        float calories(size_t index) const { return record(index).calories; } // NaN for composites that cannot be built
+        size_t keywordCount(size_t index) const { return record(index).keywordCount; }
+
+        string_view keyword(size_t index, size_t k) const
+        {
+            return text(read<StringRef>(keywordRefs, record(index).firstKeyword + k));
+        }
+
+        size_t find(string_view name) const
+        {
+            size_t low = 0, high = header.foodCount;
+            while (low < high)
+            {
+                size_t middle = low + (high - low) / 2;
+                if (this->name(middle) < name)
+                    low = middle + 1;
+                else
+                    high = middle;
+            }
+            return low < header.foodCount && this->name(low) == name ? low : npos;
+        }
+
+        vector<string> keywords(size_t index) const
+        {
+            vector<string> result;
+            result.reserve(keywordCount(index));
+            for (size_t k = 0; k < keywordCount(index); ++k)
+                result.emplace_back(keyword(index, k));
+            return result;
+        }
+
+        // Nutrients of a basic food, calories included (copied out: the mapping is not aligned)
+        NutrientVector nutrients(size_t index) const
+        {
+            FoodRecord food = record(index);
+            NutrientVector result;
+            if (food.nutrientRow != NO_NUTRIENTS)
+                result = read<NutrientVector>(nutrientRows, food.nutrientRow);
+            result[NutrientVector::CALORIES] = food.calories;
+            return result;
+        }
+
+        shared_ptr<Food> basicFood(size_t index) const
+        {
+            UntrackedNutrients untracked;
+            FoodRecord food = record(index);
+            if (food.untracked.length)
+                NutrientVector::fromJson(json::parse(text(food.untracked)), &untracked);
+            return make_shared<BasicFood>(string(name(index)), keywords(index), calories(index), nutrients(index),
+                                          move(untracked));
+        }
+
+        PendingComposite pendingComposite(size_t index) const
+        {
+            FoodRecord food = record(index);
+            PendingComposite composite{string(text(food.name)), keywords(index), {}};
+            composite.components.reserve(food.componentCount);
+            for (uint32_t c = 0; c < food.componentCount; ++c)
+            {
+                ComponentRecord edge = read<ComponentRecord>(componentRecords, food.firstComponent + c);
+                composite.components.push_back({string(text(edge.name)), edge.servings});
+            }
+            return composite;
+        }
+
+        // Copies foods whose names are not already in either output
+        void copyInto(map<string, shared_ptr<Food>> &basics, map<string, PendingComposite> &pending) const
+        {
+            for (size_t i = 0; i < size(); ++i)
+            {
+                string foodName(name(i));
+                if (basics.count(foodName) || pending.count(foodName))
+                    continue;
+                if (isComposite(i))
+                    pending.emplace(move(foodName), pendingComposite(i));
+                else
+                    basics.emplace(move(foodName), basicFood(i));
+            }
+        }
+    };
+};
+
+// Food read straight from a mapped snapshot record. Composite totals are the
+// ones computed when the snapshot was written.
+class Food::View
+{
+private:
+    const CatalogSnapshot::View *catalog;
+    size_t index;
+
+public:
+    View(const CatalogSnapshot::View &c, size_t i) : catalog(&c), index(i) {}
+
+    string_view getName() const { return catalog->name(index); }
+    bool isComposite() const { return catalog->isComposite(index); }
+    string_view getType() const { return isComposite() ? "composite" : "basic"; }
+    float getCalories() const { return catalog->calories(index); }
+    size_t keywordCount() const { return catalog->keywordCount(index); }
+    string_view keyword(size_t k) const { return catalog->keyword(index, k); }
+};
+
+// Resolves pending composite foods in dependency order using Kahn's algorithm
+// over integer ids: O(V + E), no recursion and one name lookup per edge.
+class CompositeResolver
+{
+public:
+    struct Report
+    {
+        vector<pair<string, string>> dangling; // (composite, missing component)
+        vector<string> cyclic;                 // composites in or behind a cycle
+    };
+
+private:
+    static constexpr uint32_t EXTERNAL = numeric_limits<uint32_t>::max();
+
+    struct Edge
+    {
+        uint32_t dependency; // id of a pending composite, or EXTERNAL
+        shared_ptr<Food> food; // set when the component is already loaded
+        float servings;
+    };
+
+public:
+    // Builds every composite in `pending` into `foods`. Names already present in
+    // `foods` win over pending composites of the same name. Components found
+    // nowhere else are looked up through `fallback`; missing components are
+    // dropped from their composite and composites on a cycle are skipped.
+    static Report resolve(const map<string, PendingComposite> &pending, map<string, shared_ptr<Food>> &foods,
+                          const function<shared_ptr<Food>(const string &)> &fallback = nullptr)
+    {
+        Report report;
+
+        vector<const PendingComposite *> nodes;
+        unordered_map<string_view, uint32_t> idOf;
+        nodes.reserve(pending.size());
+        for (const auto &[name, composite] : pending)
+        {
+            if (foods.count(name))
+                continue;
+            idOf.emplace(name, static_cast<uint32_t>(nodes.size()));
+            nodes.push_back(&composite);
+        }
+
+        const size_t n = nodes.size();
+        vector<uint32_t> edgeBegin(n + 1, 0);
+        vector<Edge> edges;
+        vector<uint32_t> indegree(n, 0);
+        vector<uint32_t> dependentCount(n, 0);
+
+        // Resolve every component name exactly once
+        for (uint32_t id = 0; id < n; ++id)
+        {
+            edgeBegin[id] = static_cast<uint32_t>(edges.size());
+            for (const auto &component : nodes[id]->components)
+            {
+                auto loaded = foods.find(component.name);
+                if (loaded != foods.end())
+                {
+                    edges.push_back({EXTERNAL, loaded->second, component.servings});
+                    continue;
+                }
+
+                auto dependency = idOf.find(component.name);
+                if (dependency == idOf.end())
+                {
+                    if (shared_ptr<Food> external = fallback ? fallback(component.name) : nullptr)
+                        edges.push_back({EXTERNAL, external, component.servings});
+                    else
+                        report.dangling.emplace_back(nodes[id]->name, component.name);
+                    continue;
+                }
+
+                edges.push_back({dependency->second, nullptr, component.servings});
+                ++indegree[id];
+                ++dependentCount[dependency->second];
+            }
+        }
+        edgeBegin[n] = static_cast<uint32_t>(edges.size());
+
+        // Reverse adjacency (dependency -> dependents) in CSR form
+        vector<uint32_t> dependentBegin(n + 1, 0);
+        for (size_t id = 0; id < n; ++id)
+            dependentBegin[id + 1] = dependentBegin[id] + dependentCount[id];
+        vector<uint32_t> dependents(dependentBegin[n]);
+        vector<uint32_t> fill(dependentBegin.begin(), dependentBegin.end() - 1);
+        for (uint32_t id = 0; id < n; ++id)
+        {
+            for (uint32_t e = edgeBegin[id]; e < edgeBegin[id + 1]; ++e)
+            {
+                if (edges[e].dependency != EXTERNAL)
+                    dependents[fill[edges[e].dependency]++] = id;
+            }
+        }
+
+        vector<uint32_t> ready;
+        for (uint32_t id = 0; id < n; ++id)
+        {
+            if (indegree[id] == 0)
+                ready.push_back(id);
+        }
+
+        vector<shared_ptr<Food>> built(n);
+        while (!ready.empty())
+        {
+            uint32_t id = ready.back();
+            ready.pop_back();
+
+            vector<FoodComponent> components;
+            components.reserve(edgeBegin[id + 1] - edgeBegin[id]);
+            for (uint32_t e = edgeBegin[id]; e < edgeBegin[id + 1]; ++e)
+            {
+                const Edge &edge = edges[e];
+                components.emplace_back(edge.dependency == EXTERNAL ? edge.food : built[edge.dependency], edge.servings);
+            }
+
+            const PendingComposite &composite = *nodes[id];
+            built[id] = make_shared<CompositeFood>(composite.name, composite.keywords, components);
+            foods.emplace(composite.name, built[id]);
+
+            for (uint32_t d = dependentBegin[id]; d < dependentBegin[id + 1]; ++d)
+            {
+                if (--indegree[dependents[d]] == 0)
+                    ready.push_back(dependents[d]);
+            }
+        }
+
+        for (uint32_t id = 0; id < n; ++id)
+        {
+            if (!built[id])
+                report.cyclic.push_back(nodes[id]->name);
+        }
+        return report;
+    }
+};
+
+// Parses large food catalogs on several threads. The top-level array is split
+// into element spans by a structural scan, spans are grouped into chunks and
+// each chunk is parsed by a worker with its own SAX handler. Results are merged
+// in file order, so duplicate names resolve exactly as in the serial loader.
+class ParallelCatalogParser
+{
+public:
+    // Catalogs smaller than this are not worth the thread start-up cost
+    static constexpr size_t MIN_PARALLEL_BYTES = 1 << 20;
+
+private:
+    struct Span
+    {
+        size_t begin;
+        size_t end;
+    };
+
+    struct ChunkResult
+    {
+        map<string, shared_ptr<Food>> basics;
+        map<string, PendingComposite> pending;
+        bool ok = true;
+    };
+
+    static bool isWhitespace(char c)
+    {
+        return c == ' ' || c == '\n' || c == '\r' || c == '\t';
+    }
+
+    // Finds the byte range of every element of the top-level array.
+    // Returns false if the text is not a well-delimited array.
+    static bool splitTopLevelArray(const char *data, size_t size, vector<Span> &spans)
+    {
+        size_t i = 0;
+        while (i < size && isWhitespace(data[i]))
+            ++i;
+        if (i == size || data[i] != '[')
+            return false;
+
+        const size_t none = numeric_limits<size_t>::max();
+        size_t start = none;
+        size_t depth = 0;
+        bool inString = false;
+
+        for (++i; i < size; ++i)
+        {
+            char c = data[i];
+            if (inString)
+            {
+                if (c == '\\')
+                    ++i;
+                else if (c == '"')
+                    inString = false;
+                continue;
+            }
+
+            switch (c)
+            {
+            case '"':
+                inString = true;
+                if (start == none)
+                    start = i;
+                break;
+            case '{':
+            case '[':
+                if (start == none)
+                    start = i;
+                ++depth;
+                break;
+            case '}':
+            case ']':
+                if (depth == 0)
+                {
+                    // End of the top-level array
+                    if (c != ']' || (start == none && !spans.empty()))
+                        return false;
+                    if (start != none)
+                        spans.push_back({start, i});
+                    // Only whitespace may follow, as for the serial parsers
+                    for (++i; i < size; ++i)
+                    {
+                        if (!isWhitespace(data[i]))
+                            return false;
+                    }
+                    return true;
+                }
+                --depth;
+                break;
+            case ',':
+                if (depth == 0)
+                {
+                    if (start == none)
+                        return false;
+                    spans.push_back({start, i});
+                    start = none;
+                }
+                break;
+            default:
+                if (start == none && !isWhitespace(c))
+                    start = i;
+            }
+        }
+        return false;
+    }
+
+public:
+    // Parses `data` into basic foods and pending composites using up to
+    // `threadCount` threads. Returns false on any malformed input, in which case
+    // the caller should fall back to the serial parser for its diagnostics.
+    static bool parse(const char *data, size_t size, unsigned threadCount,
+                      map<string, shared_ptr<Food>> &basics, map<string, PendingComposite> &pending)
+    {
+        vector<Span> spans;
+        if (!splitTopLevelArray(data, size, spans))
+            return false;
+
+        // A few chunks per thread keeps the workers balanced
+        size_t chunkCount = min<size_t>(spans.size(), size_t(threadCount) * 4);
+        if (chunkCount == 0)
+            return true;
+        vector<size_t> chunkBegin(chunkCount + 1);
+        for (size_t c = 0; c <= chunkCount; ++c)
+            chunkBegin[c] = spans.size() * c / chunkCount;
+
+        vector<ChunkResult> results(chunkCount);
+        atomic<size_t> nextChunk{0};
+
+        auto worker = [&]()
+        {
+            for (size_t c = nextChunk++; c < chunkCount; c = nextChunk++)
+            {
+                ChunkResult &result = results[c];
+                try
+                {
+                    for (size_t e = chunkBegin[c]; e < chunkBegin[c + 1]; ++e)
+                    {
+                        const char *begin = data + spans[e].begin, *end = data + spans[e].end;
+                        if (FoodCatalogFastParser::parseElement(begin, end, result.basics, result.pending))
+                            continue;
+                        FoodCatalogSaxHandler handler(result.basics, result.pending, true);
+                        json::sax_parse(begin, end, &handler);
+                    }
+                }
+                catch (const exception &)
+                {
+                    result.ok = false;
+                }
+            }
+        };
+
+        vector<thread> workers;
+        for (unsigned t = 1; t < min<size_t>(threadCount, chunkCount); ++t)
+            workers.emplace_back(worker);
+        worker();
+        for (auto &w : workers)
+            w.join();
+
+        for (auto &result : results)
+        {
+            if (!result.ok)
+                return false;
+        }
+
+        // Merge in file order: later definitions replace earlier ones
+        for (auto &result : results)
+        {
+            for (auto &[name, food] : result.basics)
+                basics[name] = move(food);
+            for (auto &[name, composite] : result.pending)
+                pending[name] = move(composite);
+        }
+        return true;
+    }
+};
+
+// Bulk import of basic foods from CSV/TSV nutrient tables. The file is
+// memory-mapped and its rows are split at line boundaries into one range per
+// thread; fields may be quoted ("..." with "" escapes) but must not contain
+// line breaks.
+class NutrientTableImporter
+{
+public:
+    // Which columns hold each food attribute (indexes into the header)
+    struct ColumnMapping
+    {
+        size_t name;
+        size_t calories;
+        vector<size_t> keywords;
+        vector<pair<size_t, size_t>> nutrients; // column, NutrientVector index
+    };
+
+    struct Result
+    {
+        vector<shared_ptr<Food>> foods;
+        size_t invalidRows = 0;
+    };
+
+private:
+    // Tables smaller than this are parsed on the calling thread
+    static constexpr size_t MIN_PARALLEL_BYTES = 1 << 20;
+
+    MappedFile mapped;
+    char delimiter;
+    vector<string> header;
+    size_t bodyOffset;
+
+    static string_view trim(string_view text)
+    {
+        while (!text.empty() && isspace(static_cast<unsigned char>(text.front())))
+            text.remove_prefix(1);
+        while (!text.empty() && isspace(static_cast<unsigned char>(text.back())))
+            text.remove_suffix(1);
+        return text;
+    }
+
+    // Splits one line into fields, unquoting as needed; `scratch` owns unquoted text
+    static void splitLine(string_view line, char delimiter, vector<string_view> &fields, deque<string> &scratch)
+    {
+        fields.clear();
+        size_t i = 0;
+        while (true)
+        {
+            if (i < line.size() && line[i] == '"')
+            {
+                string &field = scratch.emplace_back();
+                for (++i; i < line.size(); ++i)
+                {
+                    if (line[i] == '"')
+                    {
+                        if (i + 1 < line.size() && line[i + 1] == '"')
+                            ++i;
+                        else
+                            break;
+                    }
+                    field += line[i];
+                }
+                fields.push_back(field);
+                i = line.find(delimiter, i);
+            }
+            else
+            {
+                size_t end = line.find(delimiter, i);
+                fields.push_back(line.substr(i, end == string_view::npos ? string_view::npos : end - i));
+                i = end;
+            }
+
+            if (i == string_view::npos)
+                return;
+            ++i;
+        }
+    }
+
+    // Lowercases and trims keywords, splitting cells on ';', '|' or ',' and dropping repeats
+    static void addKeywords(string_view cell, vector<string> &keywords)
+    {
+        size_t start = 0;
+        while (start <= cell.size())
+        {
+            size_t end = cell.find_first_of(";|,", start);
+            if (end == string_view::npos)
+                end = cell.size();
+
+            string_view token = trim(cell.substr(start, end - start));
+            if (!token.empty())
+            {
+                string keyword(token);
+                transform(keyword.begin(), keyword.end(), keyword.begin(), ::tolower);
+                if (find(keywords.begin(), keywords.end(), keyword) == keywords.end())
+                    keywords.push_back(move(keyword));
+            }
+            start = end + 1;
+        }
+    }
+
+    void parseRange(size_t begin, size_t end, const ColumnMapping &columns, Result &result) const
+    {
+        const char *data = mapped.begin();
+        vector<string_view> fields;
+        deque<string> scratch;
+
+        while (begin < end)
+        {
+            const char *newline = static_cast<const char *>(memchr(data + begin, '\n', end - begin));
+            size_t lineEnd = newline ? static_cast<size_t>(newline - data) : end;
+            string_view line(data + begin, lineEnd - begin);
+            begin = lineEnd + 1;
+
+            if (!line.empty() && line.back() == '\r')
+                line.remove_suffix(1);
+            if (trim(line).empty())
+                continue;
+
+            scratch.clear();
+            splitLine(line, delimiter, fields, scratch);
+
+            float calories = 0.0f;
+            string_view name = columns.name < fields.size() ? trim(fields[columns.name]) : string_view();
+            string_view caloriesText = columns.calories < fields.size() ? trim(fields[columns.calories]) : string_view();
+            auto parsed = from_chars(caloriesText.data(), caloriesText.data() + caloriesText.size(), calories);
+            if (name.empty() || caloriesText.empty() || parsed.ec != errc() ||
+                parsed.ptr != caloriesText.data() + caloriesText.size() || calories < 0)
+            {
+                ++result.invalidRows;
+                continue;
+            }
+
+            // Blank nutrient cells are unset; anything else must be a non-negative number
+            NutrientVector nutrients;
+            bool valid = true;
+            for (const auto &[column, index] : columns.nutrients)
+            {
+                string_view text = column < fields.size() ? trim(fields[column]) : string_view();
+                if (text.empty())
+                    continue;
+                auto amount = from_chars(text.data(), text.data() + text.size(), nutrients[index]);
+                if (amount.ec != errc() || amount.ptr != text.data() + text.size() || nutrients[index] < 0)
+                    valid = false;
+            }
+            if (!valid)
+            {
+                ++result.invalidRows;
+                continue;
+            }
+
+            vector<string> keywords;
+            for (size_t column : columns.keywords)
+            {
+                if (column < fields.size())
+                    addKeywords(fields[column], keywords);
+            }
+            result.foods.push_back(make_shared<BasicFood>(string(name), keywords, calories, nutrients));
+        }
+    }
+
+public:
+    NutrientTableImporter() : delimiter(','), bodyOffset(0) {}
+
+    // Maps the file and reads its header row
+    bool open(const string &path)
+    {
+        if (!mapped.map(path))
+            return false;
+
+        const char *data = mapped.begin();
+        size_t size = mapped.size();
+        size_t start = 0;
+        if (size >= 3 && memcmp(data, "\xEF\xBB\xBF", 3) == 0)
+            start = 3; // UTF-8 byte order mark
+
+        const char *newline = static_cast<const char *>(memchr(data + start, '\n', size - start));
+        size_t headerEnd = newline ? static_cast<size_t>(newline - data) : size;
+        string_view headerLine(data + start, headerEnd - start);
+        if (!headerLine.empty() && headerLine.back() == '\r')
+            headerLine.remove_suffix(1);
+
+        bool isTsv = path.size() >= 4 && path.compare(path.size() - 4, 4, ".tsv") == 0;
+        delimiter = isTsv || headerLine.find('\t') != string_view::npos ? '\t' : ',';
+
+        vector<string_view> fields;
+        deque<string> scratch;
+        splitLine(headerLine, delimiter, fields, scratch);
+        header.clear();
+        for (auto field : fields)
+            header.emplace_back(trim(field));
+
+        bodyOffset = min(headerEnd + 1, size);
+        return true;
+    }
+
+    const vector<string> &columns() const { return header; }
+
+    // Index of the column with this header name (case-insensitive), or npos
+    size_t findColumn(string_view name) const
+    {
+        name = trim(name);
+        for (size_t i = 0; i < header.size(); ++i)
+        {
+            if (header[i].size() == name.size() &&
+                equal(header[i].begin(), header[i].end(), name.begin(), [](char a, char b)
+                      { return tolower(static_cast<unsigned char>(a)) == tolower(static_cast<unsigned char>(b)); }))
+                return i;
+        }
+        return string_view::npos;
+    }
+
+    // Parses every data row, in parallel for large tables; rows keep file order
+    Result parse(const ColumnMapping &columns) const
+    {
+        size_t size = mapped.size();
+        unsigned threads = size - bodyOffset < MIN_PARALLEL_BYTES ? 1 : max(1u, thread::hardware_concurrency());
+
+        // Cut the body into one range per thread, each ending on a line break
+        vector<size_t> bounds{bodyOffset};
+        for (unsigned t = 1; t < threads; ++t)
+        {
+            size_t cut = max(bounds.back(), bodyOffset + (size - bodyOffset) * t / threads);
+            const char *newline = static_cast<const char *>(memchr(mapped.begin() + cut, '\n', size - cut));
+            bounds.push_back(newline ? static_cast<size_t>(newline - mapped.begin()) + 1 : size);
+        }
+        bounds.push_back(size);
+
+        vector<Result> parts(threads);
+        vector<thread> workers;
+        for (unsigned t = 1; t < threads; ++t)
+            workers.emplace_back([&, t]()
+                                 { parseRange(bounds[t], bounds[t + 1], columns, parts[t]); });
+        parseRange(bounds[0], bounds[1], columns, parts[0]);
+        for (auto &worker : workers)
+            worker.join();
+
+        Result result = move(parts[0]);
+        for (unsigned t = 1; t < threads; ++t)
+        {
+            result.invalidRows += parts[t].invalidRows;
+            result.foods.insert(result.foods.end(), make_move_iterator(parts[t].foods.begin()),
+                                make_move_iterator(parts[t].foods.end()));
+        }
+        return result;
+    }
+};
+
+// Catalog split into shard files by a hash of the food name, plus a manifest
+// tying them to the JSON file they were built from. Each shard is an ordinary
+// catalog array, so it loads with the regular SAX handler.
+class ShardedCatalog
+{
+public:
+    static constexpr uint32_t VERSION = 3;
+
+    // Small and fixed-size apart from one count per shard, so reading it at
+    // startup does not grow with the catalog. Names are only known once their
+    // shard is loaded; how many embedded foods each shard shadows is counted
+    // when it is built, for the embedded catalog `embeddedFingerprint` names.
+    struct Manifest
+    {
+        uint32_t shardCount = 0;
+        uint64_t foodCount = 0;
+        vector<uint64_t> shardFoods;    // foods per shard
+        vector<uint64_t> shardEmbedded; // of those, names the embedded catalog has too
+        uint32_t embeddedFingerprint = 0;
+    };
+
+    // One food as listed in a shard; composite calories were computed when the shard was built
+    struct Row
+    {
+        string name;
+        bool composite;
+        float calories;
+        vector<string> keywords;
+    };
+
+    // 32-bit FNV-1a
+    static uint32_t hash(string_view name)
+    {
+        uint32_t h = 2166136261u;
+        for (unsigned char c : name)
+        {
+            h ^= c;
+            h *= 16777619u;
+        }
+        return h;
+    }
+
+    static string directory(const string &databasePath)
+    {
+        return databasePath + ".shards";
+    }
+
+    static string shardPath(const string &dir, uint32_t shard)
+    {
+        char file[32];
+        snprintf(file, sizeof(file), "/shard-%04u.json", shard);
+        return dir + file;
+    }
+
+    static string manifestPath(const string &dir)
+    {
+        return dir + "/manifest.json";
+    }
+
+    // Reads the manifest if the shards were built from `source` alongside the
+    // embedded catalog with `embeddedFingerprint`
+    static bool readManifest(const string &dir, const FileStamp &source, uint32_t embeddedFingerprint, Manifest &manifest)
+    {
+        // Shards are derived files, so a hand edit is as untrustworthy as damage
+        DataIntegrity::Status status = DataIntegrity::verify(manifestPath(dir));
+        if (status == DataIntegrity::Status::CORRUPT || status == DataIntegrity::Status::EDITED)
+            return false;
+        ifstream file(manifestPath(dir));
+        if (!file.is_open())
+            return false;
+        try
+        {
+            json j;
+            file >> j;
+            if (j.at("version") != VERSION || j.at("sourceSize") != source.size || j.at("sourceMtimeNs") != source.mtimeNs ||
+                j.at("embeddedFingerprint") != embeddedFingerprint)
+                return false;
+            manifest.shardCount = j.at("shards");
+            manifest.foodCount = j.at("foods");
+            manifest.shardFoods = j.at("shardFoods").get<vector<uint64_t>>();
+            manifest.shardEmbedded = j.at("shardEmbedded").get<vector<uint64_t>>();
+            manifest.embeddedFingerprint = embeddedFingerprint;
+            return manifest.shardCount > 0 && manifest.shardFoods.size() == manifest.shardCount &&
+                   manifest.shardEmbedded.size() == manifest.shardCount;
+        }
+        catch (const exception &)
+        {
+            return false;
+        }
+    }
+
+    // Writes every shard, then the manifest, each atomically. `catalog` must be
+    // fully resolved so composite calories can be stored with the shards;
+    // `embedded` tells whether a name is in the embedded catalog with
+    // `embeddedFingerprint`. With `changed`, only the shards holding those
+    // foods are rewritten, plus any shard file that is not intact.
+    static bool write(const string &dir, const map<string, shared_ptr<Food>> &catalog, uint32_t shardCount,
+                      const FileStamp &source, const function<bool(const string &)> &embedded,
+                      uint32_t embeddedFingerprint, const set<string> *changed = nullptr)
+    {
+        if (::mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST)
+            return false;
+
+        vector<vector<const Food *>> shards(shardCount);
+        for (const auto &[name, food] : catalog)
+            shards[hash(name) % shardCount].push_back(food.get());
+
+        vector<bool> dirty(shardCount, changed == nullptr);
+        for (const string &name : changed ? *changed : set<string>())
+        {
+            dirty[hash(name) % shardCount] = true;
+            // Composites containing a changed food store new calories too
+            auto food = catalog.find(name);
+            if (food != catalog.end())
+            {
+                for (const string &dependent : food->second->dependentNames())
+                    dirty[hash(dependent) % shardCount] = true;
+            }
+        }
+
+        for (uint32_t shard = 0; shard < shardCount; ++shard)
+        {
+            if (!dirty[shard] && DataIntegrity::verify(shardPath(dir, shard)) == DataIntegrity::Status::VERIFIED)
+                continue;
+            JsonStreamWriter writer(-1, shards[shard].size() * 128 + 16);
+            writer.beginArray();
+            for (const Food *food : shards[shard])
+                food->writeJson(writer);
+            writer.endArray();
+            // Shards are derived from the JSON file, so no backups are kept
+            if (!PersistenceWorker::writeAtomically(shardPath(dir, shard), writer.take(), false).ok)
+                return false;
+        }
+
+        json shardFoods = json::array(), shardEmbedded = json::array();
+        for (const auto &shard : shards)
+        {
+            shardFoods.push_back(shard.size());
+            shardEmbedded.push_back(count_if(shard.begin(), shard.end(), [&](const Food *food)
+                                             { return embedded(food->getName()); }));
+        }
+        json manifest = {{"version", VERSION}, {"shards", shardCount}, {"foods", catalog.size()},
+                         {"shardFoods", move(shardFoods)}, {"shardEmbedded", move(shardEmbedded)},
+                         {"embeddedFingerprint", embeddedFingerprint},
+                         {"sourceSize", source.size}, {"sourceMtimeNs", source.mtimeNs}};
+        return PersistenceWorker::writeAtomically(manifestPath(dir), manifest.dump(2), false).ok;
+    }
+
+    // Path of a shard that exists and passes its checksum; throws otherwise
+    static string openShard(const string &dir, uint32_t shard)
+    {
+        string path = shardPath(dir, shard);
+        switch (DataIntegrity::verify(path))
+        {
+        case DataIntegrity::Status::MISSING:
+            throw runtime_error("missing shard " + path);
+        case DataIntegrity::Status::CORRUPT:
+        case DataIntegrity::Status::EDITED:
+            throw runtime_error("checksum mismatch in " + path);
+        default:
+            return path;
+        }
+    }
+
+    // Adds the foods of one shard to the maps; throws if the shard is unreadable
+    static void load(const string &dir, uint32_t shard, map<string, shared_ptr<Food>> &basics,
+                     map<string, PendingComposite> &pending)
+    {
+        ifstream file(openShard(dir, shard));
+        FoodCatalogSaxHandler handler(basics, pending);
+        json::sax_parse(file, &handler);
+    }
+
+    // Reads the rows of one shard one at a time, in name order (shards are
+    // written from the sorted catalog), straight from the mapped file; no
+    // foods are built and only the current row is held
+    class Cursor
+    {
+    private:
+        MappedFile mapped;
+        FastJsonReader reader{nullptr, nullptr};
+        bool started = false;
+        bool finished = false;
+        bool withKeywords;
+
+    public:
+        Row row;
+
+        // Opens a shard that passes its checksum; throws otherwise
+        Cursor(const string &dir, uint32_t shard, bool withKeywords = true) : withKeywords(withKeywords)
+        {
+            string path = openShard(dir, shard);
+            if (!mapped.map(path))
+                throw runtime_error("unable to map " + path);
+            reader = FastJsonReader(mapped.begin(), mapped.begin() + mapped.size());
+        }
+
+        Cursor(const Cursor &) = delete;
+        Cursor &operator=(const Cursor &) = delete;
+
+        // Moves to the next row; false at the end of the shard
+        bool next()
+        {
+            try
+            {
+                if (finished)
+                    return false;
+                if (!started)
+                {
+                    started = true;
+                    reader.expect('[');
+                    finished = reader.consume(']');
+                }
+                else if (!reader.consume(','))
+                {
+                    reader.expect(']');
+                    finished = true;
+                }
+                if (finished)
+                    return false;
+
+                row = Row{"", false, 0.0f, {}};
+                reader.readObject([&](const string &key)
+                                  {
+                    if (key == "name")
+                        row.name = reader.readString();
+                    else if (key == "type")
+                        row.composite = reader.readString() == "composite";
+                    else if (key == "calories")
+                        row.calories = static_cast<float>(reader.readNumber());
+                    else if (key == "keywords" && withKeywords)
+                        row.keywords = reader.readStrings();
+                    else
+                        reader.skipValue(); });
+                return true;
+            }
+            catch (const FastJsonReader::Miss &)
+            {
+                throw runtime_error("malformed shard");
+            }
+        }
+    };
+};
+
+// Reference catalog compiled into the binary. embed_catalog.cpp turns a JSON
+// catalog into embedded_catalog.hpp: constexpr tables sorted by name, with
+// composite calories precomputed. Foods are served straight from the tables
+// and only become heap objects when a caller asks for one by name.
+struct EmbeddedFood
+{
+    string_view name;
+    uint32_t firstKeyword;
+    uint32_t keywordCount;
+    uint32_t firstComponent;
+    uint32_t componentCount;
+    float calories;
+    bool composite;
+    uint32_t firstNutrient;
+    uint32_t nutrientCount;
+};
+
+struct EmbeddedComponent
+{
+    uint32_t food; // index into the food table
+    float servings;
+};
+
+// Nutrients are stored by key, so the generator need not know the nutrient list
+struct EmbeddedNutrient
+{
+    string_view key;
+    float value;
+};
+
+struct EmbeddedCatalog
+{
+    const EmbeddedFood *foods;
+    size_t foodCount;
+    const string_view *keywords;
+    const EmbeddedComponent *components;
+    const EmbeddedNutrient *nutrients;
+
+    static constexpr size_t npos = numeric_limits<size_t>::max();
+
+    constexpr size_t find(string_view name) const
+    {
+        size_t low = 0, high = foodCount;
+        while (low < high)
+        {
+            size_t middle = low + (high - low) / 2;
+            if (foods[middle].name < name)
+                low = middle + 1;
+            else
+                high = middle;
+        }
+        return low < foodCount && foods[low].name == name ? low : npos;
+    }
+
+    // Identifies the set of names, so files derived with another build's tables are noticed
+    uint32_t fingerprint() const
+    {
+        uint32_t h = ShardedCatalog::hash(to_string(foodCount));
+        for (size_t i = 0; i < foodCount; ++i)
+            h = (h ^ ShardedCatalog::hash(foods[i].name)) * 16777619u;
+        return h;
+    }
+
+    const string_view *keywordsBegin(const EmbeddedFood &food) const { return keywords + food.firstKeyword; }
+    const string_view *keywordsEnd(const EmbeddedFood &food) const { return keywords + food.firstKeyword + food.keywordCount; }
+
+    // Builds the food at `index`, and any components not built yet, into `cache`
+    shared_ptr<Food> materialize(size_t index, unordered_map<size_t, shared_ptr<Food>> &cache) const
+    {
+        vector<size_t> walk{index};
+        while (!walk.empty())
+        {
+            size_t current = walk.back();
+            if (cache.count(current))
+            {
+                walk.pop_back();
+                continue;
+            }
+
+            const EmbeddedFood &food = foods[current];
+            vector<string> foodKeywords(keywordsBegin(food), keywordsEnd(food));
+            if (!food.composite)
+            {
+                NutrientVector foodNutrients;
+                for (uint32_t n = 0; n < food.nutrientCount; ++n)
+                {
+                    const EmbeddedNutrient &nutrient = nutrients[food.firstNutrient + n];
+                    size_t index = NutrientVector::findDetail(nutrient.key);
+                    if (index != NutrientVector::npos)
+                        foodNutrients[index] = nutrient.value;
+                }
+                cache[current] = make_shared<BasicFood>(string(food.name), foodKeywords, food.calories, foodNutrients);
+                walk.pop_back();
+                continue;
+            }
+
+            // Components first (the generator rejects cycles)
+            bool ready = true;
+            for (uint32_t c = 0; c < food.componentCount; ++c)
+            {
+                uint32_t component = components[food.firstComponent + c].food;
+                if (!cache.count(component))
+                {
+                    walk.push_back(component);
+                    ready = false;
+                }
+            }
+            if (!ready)
+                continue;
+
+            vector<FoodComponent> parts;
+            for (uint32_t c = 0; c < food.componentCount; ++c)
+            {
+                const EmbeddedComponent &component = components[food.firstComponent + c];
+                parts.emplace_back(cache[component.food], component.servings);
+            }
+            cache[current] = make_shared<CompositeFood>(string(food.name), foodKeywords, parts);
+            walk.pop_back();
+        }
+        return cache[index];
+    }
+};
+
+// Generated tables are optional: without the header the catalog is empty
+#if __has_include("embedded_catalog.hpp")
+#include "embedded_catalog.hpp"
+#else
+constexpr EmbeddedCatalog embeddedCatalog{nullptr, 0, nullptr, nullptr, nullptr};
+#endif
+
+// Food Database Manager class
+class FoodDatabaseManager
+{
+public:
+    map<string, shared_ptr<Food>> foods;
+
+private:
+    string databaseFilePath;
+    bool modified;
+    // Foods added since the last full save, and those being saved by a running
+    // compaction; only their shards are rewritten
+    set<string> dirtyFoods;
+    set<string> compactingFoods;
+    bool unsavedCalorieUpdates = false; // shard rows may list stale composite calories
+    bool calorieUpdatedWhileCompacting = false;
+
+    // In lazy mode, composites stay as descriptors until first touched
+    bool lazyComposites;
+    map<string, PendingComposite> pendingComposites;
+
+    // The journal is compacted into the main file once it grows past this size
+    static constexpr size_t JOURNAL_COMPACT_BYTES = 1 << 20;
+    shared_future<PersistResult> compaction;
+    bool automaticCompaction = false;
+
+    // Indentation of saved JSON (4 spaces, or negative for compact output)
+    int jsonIndent = 4;
+
+    // Embedded reference foods built so far, by table index
+    unordered_map<size_t, shared_ptr<Food>> embeddedFoods;
+
+    shared_ptr<Food> getEmbeddedFood(const string &name)
+    {
+        size_t index = embeddedCatalog.find(name);
+        return index == EmbeddedCatalog::npos ? nullptr : embeddedCatalog.materialize(index, embeddedFoods);
+    }
+
+    // When a current snapshot exists the catalog is served from it, mapped
+    // read-only, and `foods`/`pendingComposites` hold only foods added
+    // locally. Shared mode also serves a snapshot this process just published.
+    bool sharedMode = false;
+    shared_ptr<const CatalogSnapshot::View> sharedCatalog;
+    map<string, shared_ptr<Food>> sharedFoods; // snapshot foods built so far
+    bool sharedTotalsStale = false;            // a calorie changed since the snapshot was mapped
+
+    shared_ptr<Food> getSharedFood(const string &name)
+    {
+        auto cached = sharedFoods.find(name);
+        if (cached != sharedFoods.end())
+            return cached->second;
+        size_t index = sharedCatalog ? sharedCatalog->find(name) : CatalogSnapshot::View::npos;
+        if (index == CatalogSnapshot::View::npos)
+            return nullptr;
+
+        // Build the food with the snapshot composites it depends on
+        map<string, PendingComposite> closure;
+        vector<size_t> toVisit{index};
+        while (!toVisit.empty())
+        {
+            size_t current = toVisit.back();
+            toVisit.pop_back();
+            string currentName(sharedCatalog->name(current));
+            if (closure.count(currentName) || sharedFoods.count(currentName))
+                continue;
+            if (!sharedCatalog->isComposite(current))
+            {
+                sharedFoods.emplace(move(currentName), sharedCatalog->basicFood(current));
+                continue;
+            }
+            PendingComposite composite = sharedCatalog->pendingComposite(current);
+            for (const auto &component : composite.components)
+            {
+                size_t dependency = sharedCatalog->find(component.name);
+                if (dependency != CatalogSnapshot::View::npos)
+                    toVisit.push_back(dependency);
+            }
+            closure.emplace(move(currentName), move(composite));
+        }
+        reportUnresolved(CompositeResolver::resolve(closure, sharedFoods, [this](const string &component)
+                                                    { return getEmbeddedFood(component); }));
+
+        cached = sharedFoods.find(name);
+        return cached != sharedFoods.end() ? cached->second : nullptr;
+    }
+
+    // In sharded mode the catalog lives in shard files and a shard is read the
+    // first time one of its names is needed; `foods`/`pendingComposites` again
+    // hold only foods added locally. Reading a shard only fills a cache, so
+    // lookups stay const.
+    uint32_t requestedShards = 0; // 0 = not sharded
+    ShardedCatalog::Manifest shardManifest;
+    mutable vector<bool> loadedShards;
+    mutable map<string, shared_ptr<Food>> shardFoods;
+    mutable map<string, PendingComposite> shardPending;
+    // Per-shard counts from the manifest, replaced by what a shard actually
+    // held once it is read, so counts always agree with inShards()
+    mutable vector<uint64_t> shardFoodCounts;
+    mutable vector<uint64_t> shardEmbeddedCounts;
+
+    string shardDirectory() const
+    {
+        return ShardedCatalog::directory(databaseFilePath);
+    }
+
+    static bool isEmbedded(const string &name)
+    {
+        return embeddedCatalog.find(name) != EmbeddedCatalog::npos;
+    }
+
+    // Prices an embedded food for the snapshot's composite totals
+    static bool embeddedCalories(const string &name, float &calories)
+    {
+        size_t index = embeddedCatalog.find(name);
+        if (index == EmbeddedCatalog::npos)
+            return false;
+        calories = embeddedCatalog.foods[index].calories;
+        return true;
+    }
+
+    // Reads the shard `name` hashes to, once
+    void loadShardFor(string_view name) const
+    {
+        uint32_t shard = ShardedCatalog::hash(name) % shardManifest.shardCount;
+        if (loadedShards[shard])
+            return;
+        loadedShards[shard] = true;
+        map<string, shared_ptr<Food>> basics;
+        map<string, PendingComposite> pending;
+        try
+        {
+            ShardedCatalog::load(shardDirectory(), shard, basics, pending);
+        }
+        catch (const exception &e)
+        {
+            cout << "Warning: Unable to load catalog shard " << shard << ": " << e.what() << endl;
+            basics.clear();
+            pending.clear();
+        }
+
+        shardFoodCounts[shard] = basics.size() + pending.size();
+        shardEmbeddedCounts[shard] = 0;
+        for (auto &[foodName, food] : basics)
+        {
+            shardEmbeddedCounts[shard] += isEmbedded(foodName);
+            shardFoods.emplace(foodName, move(food));
+        }
+        for (auto &[foodName, composite] : pending)
+        {
+            shardEmbeddedCounts[shard] += isEmbedded(foodName);
+            shardPending.emplace(foodName, move(composite));
+        }
+    }
+
+    // Reads the shard of `name` if needed; shards are only known by their counts until then
+    bool inShards(const string &name) const
+    {
+        if (!shardManifest.shardCount)
+            return false;
+        loadShardFor(name);
+        return shardFoods.count(name) || shardPending.count(name);
+    }
+
+    shared_ptr<Food> getShardFood(const string &name)
+    {
+        if (!inShards(name))
+            return nullptr;
+        auto cached = shardFoods.find(name);
+        if (cached != shardFoods.end())
+            return cached->second;
+
+        // Move the pending closure of `name` out, reading the shards of its components
+        map<string, PendingComposite> closure;
+        vector<string> toVisit{name};
+        while (!toVisit.empty())
+        {
+            string current = move(toVisit.back());
+            toVisit.pop_back();
+            loadShardFor(current);
+            auto node = shardPending.extract(current);
+            if (node.empty())
+                continue;
+            for (const auto &component : node.mapped().components)
+            {
+                if (!shardFoods.count(component.name))
+                    toVisit.push_back(component.name);
+            }
+            closure.insert(move(node));
+        }
+        reportUnresolved(CompositeResolver::resolve(closure, shardFoods, [this](const string &component)
+                                                    { return getEmbeddedFood(component); }));
+
+        cached = shardFoods.find(name);
+        return cached != shardFoods.end() ? cached->second : nullptr;
+    }
+
+    // The catalog beneath the local foods: the shared image or the shards
+    shared_ptr<Food> getBaseFood(const string &name)
+    {
+        return sharedCatalog ? getSharedFood(name) : getShardFood(name);
+    }
+
+    // A basic food of this database: local, or from the shared catalog or a shard
+    shared_ptr<BasicFood> findOwnBasicFood(const string &name)
+    {
+        auto local = foods.find(name);
+        return dynamic_pointer_cast<BasicFood>(local != foods.end() ? local->second : getBaseFood(name));
+    }
+
+    bool inBaseCatalog(string_view name) const
+    {
+        if (sharedCatalog)
+            return sharedCatalog->find(name) != CatalogSnapshot::View::npos;
+        return inShards(string(name));
+    }
+
+    // Lookup for names missing from the local foods: the base catalog, then embedded foods
+    function<shared_ptr<Food>(const string &)> readOnlyFallback()
+    {
+        return [this](const string &name)
+        {
+            shared_ptr<Food> food = getBaseFood(name);
+            return food ? food : getEmbeddedFood(name);
+        };
+    }
+
+    bool inReadOnlyLayer(string_view name) const
+    {
+        return inBaseCatalog(name) || embeddedCatalog.find(name) != EmbeddedCatalog::npos;
+    }
+
+    bool isLocal(const string &name) const
+    {
+        return foods.count(name) || pendingComposites.count(name);
+    }
+
+    // True if a user food of this name exists in any layer
+    bool nameExists(const string &name) const
+    {
+        return isLocal(name) || inReadOnlyLayer(name);
+    }
+
+    // Maps the published snapshot for `source`, shared with other processes
+    bool attachSharedCatalog(const FileStamp &source)
+    {
+        auto view = make_shared<CatalogSnapshot::View>();
+        if (!view->attach(snapshotPath(), source))
+            return false;
+        sharedCatalog = move(view);
+        sharedTotalsStale = false;
+        return true;
+    }
+
+    // Uses the shard files for `source` if they exist with the requested shard count
+    bool attachShards(const FileStamp &source)
+    {
+        ShardedCatalog::Manifest manifest;
+        if (!ShardedCatalog::readManifest(shardDirectory(), source, embeddedCatalog.fingerprint(), manifest) ||
+            manifest.shardCount != requestedShards)
+            return false;
+        shardManifest = manifest;
+        loadedShards.assign(manifest.shardCount, false);
+        shardFoodCounts = manifest.shardFoods;
+        shardEmbeddedCounts = manifest.shardEmbedded;
+        return true;
+    }
+
+    // Splits a freshly parsed catalog into shards and switches to them
+    bool buildShards(const FileStamp &source, map<string, PendingComposite> &pendingFoods)
+    {
+        reportUnresolved(CompositeResolver::resolve(pendingFoods, foods, [this](const string &name)
+                                                    { return getEmbeddedFood(name); }));
+        pendingFoods.clear();
+        if (!ShardedCatalog::write(shardDirectory(), foods, requestedShards, source, isEmbedded, embeddedCatalog.fingerprint()) ||
+            !attachShards(source))
+        {
+            cout << "Warning: Unable to write catalog shards to " << shardDirectory() << endl;
+            return false;
+        }
+        foods.clear();
+        return true;
+    }
+
+    void clear()
+    {
+        foods.clear();
+        pendingComposites.clear();
+        dirtyFoods.clear();
+        unsavedCalorieUpdates = false;
+        sharedCatalog.reset();
+        sharedFoods.clear();
+        sharedTotalsStale = false;
+        shardManifest = ShardedCatalog::Manifest();
+        loadedShards.clear();
+        shardFoodCounts.clear();
+        shardEmbeddedCounts.clear();
+        shardFoods.clear();
+        shardPending.clear();
+    }
+
+    // Resolves freshly loaded composites now, or keeps them for later in lazy mode
+    void finishLoad(map<string, PendingComposite> &pendingFoods)
+    {
+        if (!lazyComposites)
+        {
+            reportUnresolved(CompositeResolver::resolve(pendingFoods, foods, readOnlyFallback()));
+            return;
+        }
+
+        // Basic foods win over composites of the same name, as in the resolver
+        for (auto it = pendingFoods.begin(); it != pendingFoods.end();)
+        {
+            if (foods.count(it->first))
+                it = pendingFoods.erase(it);
+            else
+                ++it;
+        }
+        pendingComposites = move(pendingFoods);
+    }
+
+    // Builds a pending composite, and any pending composites it depends on, into `foods`
+    shared_ptr<Food> materialize(const string &name)
+    {
+        if (pendingComposites.find(name) == pendingComposites.end())
+            return nullptr;
+
+        // Move the pending closure of `name` out of the lazy set
+        map<string, PendingComposite> closure;
+        vector<string> toVisit{name};
+        while (!toVisit.empty())
+        {
+            auto node = pendingComposites.extract(toVisit.back());
+            toVisit.pop_back();
+            if (node.empty())
+                continue;
+
+            for (const auto &component : node.mapped().components)
+            {
+                if (pendingComposites.count(component.name))
+                    toVisit.push_back(component.name);
+            }
+            closure.insert(move(node));
+        }
+
+        reportUnresolved(CompositeResolver::resolve(closure, foods, readOnlyFallback()));
+
+        auto it = foods.find(name);
+        return it != foods.end() ? it->second : nullptr;
+    }
+
+    void materializeAll()
+    {
+        if (pendingComposites.empty())
+            return;
+        reportUnresolved(CompositeResolver::resolve(pendingComposites, foods, readOnlyFallback()));
+        pendingComposites.clear();
+    }
+
+    // Prints everything the composite resolver could not link, in one batch
+    void reportUnresolved(const CompositeResolver::Report &report) const
+    {
+        if (!report.dangling.empty())
+        {
+            cout << "Warning: " << report.dangling.size() << " component(s) not found and skipped:" << endl;
+            for (const auto &[composite, component] : report.dangling)
+            {
+                cout << "  - '" << component << "' in composite food '" << composite << "'" << endl;
+            }
+        }
+        if (!report.cyclic.empty())
+        {
+            cout << "Warning: " << report.cyclic.size() << " composite food(s) form or depend on a cycle and were not loaded:" << endl;
+            for (const auto &name : report.cyclic)
+            {
+                cout << "  - " << name << endl;
+            }
+        }
+    }
+
+    // Chunked multi-threaded parse for large catalogs; false if not applicable or failed
+    bool parseInParallel(const FileStamp &source, map<string, PendingComposite> &pendingFoods)
+    {
+        unsigned threads = thread::hardware_concurrency();
+        if (threads < 2 || source.size < ParallelCatalogParser::MIN_PARALLEL_BYTES)
+            return false;
+
+        MappedFile mapped;
+        if (!mapped.map(databaseFilePath))
+            return false;
+        return ParallelCatalogParser::parse(mapped.begin(), mapped.size(), threads, foods, pendingFoods);
+    }
+
+    // Single-threaded fast path; false if the SAX parser must read the file instead
+    bool parseFast(map<string, PendingComposite> &pendingFoods)
+    {
+        MappedFile mapped;
+        if (!mapped.map(databaseFilePath))
+            return false;
+        foods.clear();
+        pendingFoods.clear();
+        return FoodCatalogFastParser::parse(mapped.begin(), mapped.size(), foods, pendingFoods);
+    }
+
+    string snapshotPath() const
+    {
+        return databaseFilePath + ".snap";
+    }
+
+    // Rebuilds the binary snapshot after the JSON file has been read or written
+    void refreshSnapshot(const map<string, PendingComposite> &pending)
+    {
+        FileStamp source;
+        if (!FileStamp::of(databaseFilePath, source) || !CatalogSnapshot::write(snapshotPath(), foods, pending, source, embeddedCalories))
+        {
+            cout << "Warning: Unable to write database snapshot " << snapshotPath() << endl;
+        }
+    }
+
+    // Journal of mutations made since the last full save, one JSON record per line
+    string journalPath() const
+    {
+        return databaseFilePath + ".journal";
+    }
+
+    // Journal being folded into the main file by a background compaction
+    string compactingJournalPath() const
+    {
+        return databaseFilePath + ".journal.compacting";
+    }
+
+    static void writeAddRecord(JsonStreamWriter &writer, const Food &food)
+    {
+        writer.beginObject();
+        writer.key("food");
+        food.writeJson(writer);
+        writer.key("op").value("add");
+        writer.endObject();
+        writer.endRecord();
+    }
+
+    static void writeUpdateRecord(JsonStreamWriter &writer, const string &name, float calories)
+    {
+        writer.beginObject();
+        writer.key("calories").value(calories);
+        writer.key("name").value(name);
+        writer.key("op").value("update");
+        writer.endObject();
+        writer.endRecord();
+    }
+
+    // Appends one or more newline-terminated records in a single write. Each
+    // line is framed as "<crc32c in hex> <record>" so replay can spot damage.
+    bool appendToJournal(const string &records)
+    {
+        string framed;
+        framed.reserve(records.size() + 64);
+        for (size_t start = 0; start < records.size();)
+        {
+            size_t end = records.find('\n', start);
+            if (end == string::npos)
+                end = records.size();
+            string_view record(records.data() + start, end - start);
+            char prefix[16];
+            snprintf(prefix, sizeof(prefix), "%08x ", Crc32c::compute(record));
+            framed.append(prefix).append(record).push_back('\n');
+            start = end + 1;
+        }
+
+        // Synced before returning: a change reported as saved must survive a crash
+        uint64_t size = 0;
+        if (!PersistenceWorker::appendDurably(journalPath(), framed, size))
+        {
+            cout << "Warning: Unable to append to journal " << journalPath() << ": " << strerror(errno) << endl;
+            return false;
+        }
+
+        if (size >= JOURNAL_COMPACT_BYTES && !isCompacting())
+            startCompaction(true);
+        return true;
+    }
+
+    // Applies journal records on top of the loaded catalog; returns the number applied
+    size_t replayJournal(const string &path, map<string, PendingComposite> &pendingFoods)
+    {
+        ifstream journal(path);
+        size_t applied = 0;
+        string line;
+        while (getline(journal, line))
+        {
+            if (line.empty())
+                continue;
+
+            // Unframed lines come from journals written before records carried a checksum
+            string_view payload = line;
+            if (line[0] != '{')
+            {
+                uint32_t expected = 0;
+                auto parsed = from_chars(line.data(), line.data() + min<size_t>(line.size(), 8), expected, 16);
+                if (line.size() < 10 || parsed.ptr != line.data() + 8 || line[8] != ' ' ||
+                    Crc32c::compute(payload = payload.substr(9)) != expected)
+                {
+                    cout << "Warning: Skipping damaged journal record in " << path << endl;
+                    continue;
+                }
+            }
+            try
+            {
+                json record = json::parse(payload);
+                if (record["op"] == "add")
+                {
+                    const json &foodJson = record["food"];
+                    string name = foodJson["name"];
+                    if (foodJson["type"] == "composite")
+                    {
+                        foods.erase(name);
+                        pendingFoods[name] = PendingComposite::fromJson(foodJson);
+                    }
+                    else
+                    {
+                        pendingFoods.erase(name);
+                        foods[name] = BasicFood::fromJson(foodJson);
+                    }
+                    dirtyFoods.insert(name);
+                    ++applied;
+                }
+                else if (record["op"] == "update")
+                {
+                    string name = record["name"];
+                    auto basic = findOwnBasicFood(name);
+                    if (!basic)
+                    {
+                        cout << "Warning: Skipping update of unknown food " << name << " in " << path << endl;
+                        continue;
+                    }
+                    foods[name] = basic;
+                    basic->setCalories(record["calories"].get<float>());
+                    dirtyFoods.insert(name);
+                    noteCalorieUpdate();
+                    ++applied;
+                }
+            }
+            catch (const exception &e)
+            {
+                // A torn final record from an interrupted append
+                cout << "Warning: Skipping unreadable journal record in " << path << ": " << e.what() << endl;
+            }
+        }
+        return applied;
+    }
+
+    static string serializeCatalog(const map<string, shared_ptr<Food>> &catalog, int indent)
+    {
+        JsonStreamWriter writer(indent, catalog.size() * 256);
+        writer.beginArray();
+        for (const auto &[name, food] : catalog)
+        {
+            food->writeJson(writer);
+        }
+        writer.endArray();
+        return writer.take();
+    }
+
+    // Moves the journal aside for a full save. Records left behind by an earlier
+    // failed save are kept: the current journal is appended to them instead.
+    void rotateJournal()
+    {
+        ifstream journal(journalPath(), ios::binary);
+        if (!journal.is_open())
+            return;
+
+        if (!ifstream(compactingJournalPath()).is_open())
+        {
+            journal.close();
+            ::rename(journalPath().c_str(), compactingJournalPath().c_str());
+            return;
+        }
+
+        ofstream rotated(compactingJournalPath(), ios::binary | ios::app);
+        rotated << journal.rdbuf();
+        rotated.close();
+        journal.close();
+        if (rotated.good())
+            ::remove(journalPath().c_str());
+    }
+
+    // Writes the whole catalog through the persistence worker. The journal is
+    // rotated first, so records appended meanwhile land in a fresh journal; the
+    // rotated one is removed only once the new file is in place.
+    shared_future<PersistResult> startCompaction(bool automatic)
+    {
+        waitForCompaction();
+        rotateJournal();
+
+        // The worker shares the foods: all that can change in them, calories and
+        // cached totals, is atomic. Pending composites are copied and resolved
+        // privately on the worker.
+        struct CatalogCopy
+        {
+            map<string, shared_ptr<Food>> catalog;
+            map<string, PendingComposite> pending;
+        };
+        auto copy = make_shared<CatalogCopy>(CatalogCopy{foods, pendingComposites});
+        compactingFoods.insert(dirtyFoods.begin(), dirtyFoods.end());
+        dirtyFoods.clear();
+        calorieUpdatedWhileCompacting = false;
+        auto changed = make_shared<set<string>>(compactingFoods);
+        shared_ptr<const CatalogSnapshot::View> shared = sharedCatalog;
+        string shardDir = shardDirectory();
+        uint32_t shards = shardManifest.shardCount;
+        string path = databaseFilePath;
+        string snapshot = snapshotPath();
+        string rotated = compactingJournalPath();
+
+        compaction = PersistenceWorker::instance()
+                         .submit(
+                             path,
+                             [copy, shared, shardDir, shards, indent = jsonIndent]()
+                             {
+                                 // The mapped image and the shard files are immutable, so the worker reads them directly
+                                 if (shared)
+                                     shared->copyInto(copy->catalog, copy->pending);
+                                 for (uint32_t shard = 0; shard < shards; ++shard)
+                                 {
+                                     map<string, shared_ptr<Food>> basics;
+                                     map<string, PendingComposite> composites;
+                                     ShardedCatalog::load(shardDir, shard, basics, composites);
+                                     for (auto &[name, food] : basics)
+                                     {
+                                         if (!copy->pending.count(name))
+                                             copy->catalog.emplace(name, move(food));
+                                     }
+                                     for (auto &[name, composite] : composites)
+                                     {
+                                         if (!copy->catalog.count(name))
+                                             copy->pending.emplace(name, move(composite));
+                                     }
+                                 }
+                                 // Private cache: the UI thread owns embeddedFoods
+                                 unordered_map<size_t, shared_ptr<Food>> embedded;
+                                 CompositeResolver::resolve(copy->pending, copy->catalog, [&embedded](const string &name)
+                                                            {
+                                     size_t index = embeddedCatalog.find(name);
+                                     return index == EmbeddedCatalog::npos ? nullptr : embeddedCatalog.materialize(index, embedded); });
+                                 copy->pending.clear();
+                                 return serializeCatalog(copy->catalog, indent);
+                             },
+                             [copy, changed, path, snapshot, rotated, shardDir, shards]()
+                             {
+                                 FileStamp source;
+                                 bool shardsWritten = !shards;
+                                 if (FileStamp::of(path, source))
+                                 {
+                                     CatalogSnapshot::write(snapshot, copy->catalog, copy->pending, source, embeddedCalories);
+                                     if (shards)
+                                         shardsWritten = ShardedCatalog::write(shardDir, copy->catalog, shards, source, isEmbedded,
+                                                                               embeddedCatalog.fingerprint(), changed.get());
+                                 }
+                                 ::remove(rotated.c_str());
+                                 // The JSON file is saved either way; the error only marks the shards stale
+                                 if (!shardsWritten)
+                                     throw runtime_error("Unable to rewrite the catalog shards");
+                             })
+                         .share();
+        automaticCompaction = automatic;
+        modified = false;
+        return compaction;
+    }
+
+    bool isCompacting() const
+    {
+        return compaction.valid() && compaction.wait_for(chrono::seconds(0)) != future_status::ready;
+    }
+
+    // Stored composite totals are stale until a full save rewrites the shards
+    void noteCalorieUpdate()
+    {
+        unsavedCalorieUpdates = true;
+        // The mapped snapshot is not swapped on save, so its totals stay stale
+        sharedTotalsStale = sharedCatalog != nullptr;
+        if (compaction.valid())
+            calorieUpdatedWhileCompacting = true;
+    }
+
+    void waitForCompaction()
+    {
+        if (!compaction.valid())
+            return;
+
+        PersistResult result = compaction.get();
+        if (!result.ok)
+        {
+            // The rotated journal is kept, so nothing is lost; the foods stay dirty
+            modified = true;
+            dirtyFoods.insert(compactingFoods.begin(), compactingFoods.end());
+            if (automaticCompaction)
+                cout << "Warning: Background compaction failed: " << result.error << endl;
+        }
+        else if (result.error.empty() && !calorieUpdatedWhileCompacting)
+        {
+            // The shards now list current composite totals
+            unsavedCalorieUpdates = false;
+        }
+        compactingFoods.clear();
+        compaction = shared_future<PersistResult>();
+    }
+
+public:
+    FoodDatabaseManager(const string &filePath = "food_database.json", bool lazy = false)
+        : databaseFilePath(filePath), modified(false), lazyComposites(lazy) {}
+
+    ~FoodDatabaseManager()
+    {
+        waitForCompaction();
+    }
+
+    bool loadDatabase()
+    {
+        waitForCompaction();
+        clear();
+
+        DataIntegrity::recover(databaseFilePath, cout);
+        FileStamp source;
+        ifstream file(databaseFilePath);
+        bool hasDatabase = file.is_open() && FileStamp::of(databaseFilePath, source);
+        bool hasJournal = ifstream(journalPath()).is_open() || ifstream(compactingJournalPath()).is_open();
+        if (!hasDatabase && !hasJournal)
+        {
+            cout << "No existing database found. Starting with empty database." << endl;
+            return false;
+        }
+
+        try
+        {
+            // Fast path: a snapshot built from the current JSON file, attached
+            // rather than copied so foods are only built when looked up.
+            // Otherwise basic foods are built directly and composite foods are
+            // catalogued as descriptors until all names are known. In shared
+            // mode the first process to find the snapshot stale publishes a new
+            // one and serves from it too
+            map<string, PendingComposite> pendingFoods;
+            bool attached = hasDatabase && (requestedShards ? attachShards(source) : attachSharedCatalog(source));
+            if (hasDatabase && !attached)
+            {
+                if (!parseInParallel(source, pendingFoods) && !parseFast(pendingFoods))
+                {
+                    // Single streaming pass
+                    foods.clear();
+                    pendingFoods.clear();
+                    FoodCatalogSaxHandler handler(foods, pendingFoods);
+                    json::sax_parse(file, &handler);
+                }
+                refreshSnapshot(pendingFoods);
+                if (sharedMode && attachSharedCatalog(source))
+                {
+                    foods.clear();
+                    pendingFoods.clear();
+                    attached = true;
+                }
+            }
+            // First sharded load of this JSON file: split it up for next time
+            if (hasDatabase && !attached && requestedShards)
+                buildShards(source, pendingFoods);
+
+            // Mutations since the last full save (an interrupted compaction first)
+            size_t replayed = replayJournal(compactingJournalPath(), pendingFoods) +
+                              replayJournal(journalPath(), pendingFoods);
+            if (replayed > 0)
+            {
+                cout << "Replayed " << replayed << " journal record(s)." << endl;
+                modified = true;
+            }
+
+            // Second pass: resolve composite foods in dependency order
+            finishLoad(pendingFoods);
+
+            cout << "Database loaded: " << foodCount() << " foods." << endl;
+            return true;
+        }
+        catch (const exception &e)
+        {
+            cout << "Error loading database: " << e.what() << endl;
+            return false;
+        }
+    }
+
+    // Saves the full catalog in the background; the future reports the outcome
+    shared_future<PersistResult> saveDatabaseAsync()
+    {
+        return startCompaction(false);
+    }
+
+    bool saveDatabase()
+    {
+        PersistResult result = saveDatabaseAsync().get();
+        waitForCompaction();
+        if (!result.ok)
+        {
+            cout << "Error saving database: " << result.error << endl;
+            return false;
+        }
+
+        cout << "Database saved to " << databaseFilePath << endl;
+        return true;
+    }
+
+    bool addFood(shared_ptr<Food> food)
+    {
+        string name = food->getName();
+        if (nameExists(name))
+        {
+            cout << "Error: A food with name '" << name << "' already exists." << endl;
+            return false;
+        }
+
+        foods[name] = food;
+        modified = true;
+        dirtyFoods.insert(name);
+
+        JsonStreamWriter record(-1, 256);
+        writeAddRecord(record, *food);
+        appendToJournal(record.take());
+        return true;
+    }
+
+    // Changes the calories of a basic food of this database (reference foods
+    // are read-only). Composites containing it recompute on their next read,
+    // and are saved again along with it. A food from the shared catalog or a
+    // shard is changed in place and kept as a local food from then on.
+    bool updateFoodCalories(const string &name, float calories)
+    {
+        auto basic = findOwnBasicFood(name);
+        if (!basic)
+        {
+            cout << "Error: '" << name << "' is not a basic food in your database." << endl;
+            return false;
+        }
+
+        foods[name] = basic;
+        basic->setCalories(calories);
+        modified = true;
+        noteCalorieUpdate();
+        dirtyFoods.insert(name);
+        for (const string &dependent : basic->dependentNames())
+            dirtyFoods.insert(dependent);
+
+        JsonStreamWriter record(-1, 128);
+        writeUpdateRecord(record, name, calories);
+        appendToJournal(record.take());
+        return true;
+    }
+
+    // Adds many foods at once. The batch is sorted so map insertion uses hints,
+    // and journaling and bookkeeping happen once for the whole batch. Foods whose
+    // name already exists (or repeats within the batch) are skipped.
+    size_t addFoodsBatch(vector<shared_ptr<Food>> batch, size_t *duplicates = nullptr)
+    {
+        sort(batch.begin(), batch.end(), [](const shared_ptr<Food> &a, const shared_ptr<Food> &b)
+             { return a->getName() < b->getName(); });
+
+        JsonStreamWriter records(-1, batch.size() * 160);
+        size_t added = 0;
+        auto hint = foods.begin();
+        for (auto &food : batch)
+        {
+            // Sorted input: the insertion point only moves forward, usually by a step or two
+            const string &name = food->getName();
+            for (int steps = 0; hint != foods.end() && hint->first < name && steps < 8; ++steps)
+                ++hint;
+            if (hint != foods.end() && hint->first < name)
+                hint = foods.lower_bound(name);
+            if ((hint != foods.end() && hint->first == name) || pendingComposites.count(name) || inReadOnlyLayer(name))
+                continue;
+
+            writeAddRecord(records, *food);
+            dirtyFoods.insert(name);
+            hint = foods.emplace_hint(hint, name, move(food));
+            ++added;
+        }
+
+        if (duplicates)
+            *duplicates = batch.size() - added;
+        if (added > 0)
+        {
+            modified = true;
+            appendToJournal(records.take());
+        }
+        return added;
+    }
+
+    vector<shared_ptr<Food>> searchFoodsByKeywords(const vector<string> &keywords, bool matchall)
+    {
+        vector<string> lowerKeywords;
+        for (const auto &keyword : keywords)
+        {
+            string lowerKeyword = keyword;
+            transform(lowerKeyword.begin(), lowerKeyword.end(), lowerKeyword.begin(), ::tolower);
+            lowerKeywords.push_back(lowerKeyword);
+        }
+
+        // if matchall is there, we need foods with all keywords, else food which atleast one keyword
+        auto matches = [&](size_t keywordCount, auto keywordAt)
+        {
+            size_t cnt = 0;
+            for (const auto &lowerKeyword : lowerKeywords)
+            {
+                for (size_t k = 0; k < keywordCount; ++k)
+                {
+                    string lowerFoodKeyword(keywordAt(k));
+                    transform(lowerFoodKeyword.begin(), lowerFoodKeyword.end(), lowerFoodKeyword.begin(), ::tolower);
+                    if (lowerFoodKeyword.find(lowerKeyword) != string::npos)
+                    {
+                        cnt++;
+                        break;
+                    }
+                }
+            }
+            return matchall ? cnt == lowerKeywords.size() : cnt > 0;
+        };
+
+        // Match against every layer without materializing anything
+        vector<string> matched;
+        for (const auto &[name, food] : foods)
+        {
+            const vector<string> &foodKeywords = food->getKeywords();
+            if (matches(foodKeywords.size(), [&](size_t k) -> const string &
+                        { return foodKeywords[k]; }))
+                matched.push_back(name);
+        }
+        for (const auto &[name, composite] : pendingComposites)
+        {
+            if (matches(composite.keywords.size(), [&](size_t k) -> const string &
+                        { return composite.keywords[k]; }))
+                matched.push_back(name);
+        }
+        for (size_t i = 0; sharedCatalog && i < sharedCatalog->size(); ++i)
+        {
+            Food::View food(*sharedCatalog, i);
+            if (matches(food.keywordCount(), [&](size_t k)
+                        { return food.keyword(k); }))
+            {
+                string name(food.getName());
+                if (!isLocal(name))
+                    matched.push_back(move(name));
+            }
+        }
+        // Matching embedded foods, unless a shard turns out to shadow them
+        unordered_set<string> embeddedMatches;
+        for (size_t i = 0; i < embeddedCatalog.foodCount; ++i)
+        {
+            const EmbeddedFood &food = embeddedCatalog.foods[i];
+            if (matches(food.keywordCount, [&](size_t k)
+                        { return embeddedCatalog.keywordsBegin(food)[k]; }))
+            {
+                string name(food.name);
+                if (!isLocal(name) && !(sharedCatalog && sharedCatalog->find(name) != CatalogSnapshot::View::npos))
+                    embeddedMatches.insert(move(name));
+            }
+        }
+        // Shards are streamed row by row, without building foods
+        for (uint32_t shard = 0; shard < shardManifest.shardCount; ++shard)
+        {
+            try
+            {
+                ShardedCatalog::Cursor cursor(shardDirectory(), shard);
+                while (cursor.next())
+                {
+                    ShardedCatalog::Row &row = cursor.row;
+                    embeddedMatches.erase(row.name);
+                    if (matches(row.keywords.size(), [&](size_t k) -> const string &
+                                { return row.keywords[k]; }) &&
+                        !isLocal(row.name))
+                        matched.push_back(move(row.name));
+                }
+            }
+            catch (const exception &e)
+            {
+                cout << "Warning: Unable to read catalog shard " << shard << ": " << e.what() << endl;
+            }
+        }
+        matched.insert(matched.end(), embeddedMatches.begin(), embeddedMatches.end());
+        sort(matched.begin(), matched.end());
+
+        vector<shared_ptr<Food>> results;
+        for (const auto &name : matched)
+        {
+            if (auto food = getFood(name))
+                results.push_back(food);
+        }
+        return results;
+    }
+
+    shared_ptr<Food> getFood(const string &name)
+    {
+        auto it = foods.find(name);
+        if (it != foods.end())
+        {
+            return it->second;
+        }
+        if (auto food = materialize(name))
+        {
+            return food;
+        }
+        if (auto food = getBaseFood(name))
+        {
+            return food;
+        }
+        return getEmbeddedFood(name);
+    }
+
+    // Number of foods in all layers, counting each name once
+    size_t foodCount() const
+    {
+        size_t count = foods.size() + pendingComposites.size() + embeddedCatalog.foodCount;
+        if (sharedCatalog)
+            count += sharedCatalog->size();
+
+        // Embedded foods the base catalog shadows: counted per shard, so no
+        // shard is read for it
+        for (size_t shard = 0; shard < shardFoodCounts.size(); ++shard)
+            count += shardFoodCounts[shard] - shardEmbeddedCounts[shard];
+        for (size_t i = 0; sharedCatalog && i < embeddedCatalog.foodCount; ++i)
+            count -= sharedCatalog->find(embeddedCatalog.foods[i].name) != CatalogSnapshot::View::npos;
+
+        // Local foods shadow both; only the shards of local names are read
+        auto countShadowed = [&](const auto &local)
+        {
+            for (const auto &entry : local)
+            {
+                bool inBase = inBaseCatalog(entry.first);
+                count -= inBase;
+                count -= !inBase && isEmbedded(entry.first);
+            }
+        };
+        countShadowed(foods);
+        countShadowed(pendingComposites);
+        return count;
+    }
+
+    // One row of the food listing
+    struct FoodListing
+    {
+        string_view name;
+        bool composite;
+        float calories;
+    };
+
+    // Visits every food in name order. Local foods shadow the base catalog,
+    // which shadows embedded foods; read-only foods are listed from their
+    // tables, and are only built when their calories must be computed.
+    template <typename Fn>
+    void forEachFood(Fn visit, bool withCalories = true)
+    {
+        materializeAll();
+
+        // Each shard is stored in name order, so the shards are merged through
+        // one cursor each: only the current row of every shard is held
+        vector<unique_ptr<ShardedCatalog::Cursor>> cursors(shardManifest.shardCount);
+        auto shardAfter = [&](uint32_t a, uint32_t b)
+        {
+            return cursors[a]->row.name > cursors[b]->row.name;
+        };
+        priority_queue<uint32_t, vector<uint32_t>, decltype(shardAfter)> shardHeap(shardAfter);
+        // Moves a shard to its next row, dropping it when it runs out or fails
+        auto advanceShard = [&](uint32_t shard)
+        {
+            try
+            {
+                if (cursors[shard]->next())
+                {
+                    shardHeap.push(shard);
+                    return;
+                }
+            }
+            catch (const exception &e)
+            {
+                cout << "Warning: Unable to read catalog shard " << shard << ": " << e.what() << endl;
+            }
+            cursors[shard].reset();
+        };
+        for (uint32_t shard = 0; shard < shardManifest.shardCount; ++shard)
+        {
+            try
+            {
+                cursors[shard] = make_unique<ShardedCatalog::Cursor>(shardDirectory(), shard, false);
+            }
+            catch (const exception &e)
+            {
+                cout << "Warning: Unable to read catalog shard " << shard << ": " << e.what() << endl;
+                continue;
+            }
+            advanceShard(shard);
+        }
+
+        size_t sharedCount = sharedCatalog ? sharedCatalog->size() : 0;
+        size_t base = 0;
+        auto baseLeft = [&]
+        {
+            return sharedCatalog ? base < sharedCount : !shardHeap.empty();
+        };
+        auto baseName = [&]
+        {
+            if (sharedCatalog)
+                return sharedCatalog->name(base);
+            return string_view(cursors[shardHeap.top()]->row.name);
+        };
+        auto advanceBase = [&]
+        {
+            if (sharedCatalog)
+            {
+                ++base;
+                return;
+            }
+            uint32_t shard = shardHeap.top();
+            shardHeap.pop();
+            advanceShard(shard);
+        };
+        auto visitBase = [&](string_view name)
+        {
+            if (!sharedCatalog)
+            {
+                const ShardedCatalog::Row &row = cursors[shardHeap.top()]->row;
+                // Stored composite totals predate calorie updates not saved yet
+                shared_ptr<Food> built = row.composite && withCalories && unsavedCalorieUpdates ? getShardFood(row.name) : nullptr;
+                visit(FoodListing{name, row.composite, built ? built->getCalories() : row.calories});
+                return;
+            }
+            Food::View food(*sharedCatalog, base);
+            bool composite = food.isComposite();
+            // Only composites whose stored total is stale or missing are built
+            bool rebuild = composite && withCalories && (sharedTotalsStale || isnan(food.getCalories()));
+            shared_ptr<Food> built = rebuild ? getSharedFood(string(name)) : nullptr;
+            // Composites that could not be built were reported and are not listed
+            if (!rebuild || built)
+                visit(FoodListing{name, composite, built ? built->getCalories() : food.getCalories()});
+        };
+
+        auto local = foods.begin();
+        size_t embedded = 0;
+        while (local != foods.end() || baseLeft() || embedded < embeddedCatalog.foodCount)
+        {
+            bool hasBaseLeft = baseLeft();
+            string_view localName = local != foods.end() ? string_view(local->first) : string_view();
+            string_view currentBase = hasBaseLeft ? baseName() : string_view();
+            string_view embeddedName = embedded < embeddedCatalog.foodCount ? embeddedCatalog.foods[embedded].name : string_view();
+
+            string_view least;
+            bool any = false;
+            for (auto [valid, name] : {pair{local != foods.end(), localName}, pair{hasBaseLeft, currentBase},
+                                       pair{embedded < embeddedCatalog.foodCount, embeddedName}})
+            {
+                if (valid && (!any || name < least))
+                {
+                    least = name;
+                    any = true;
+                }
+            }
+
+            bool hasLocal = local != foods.end() && localName == least;
+            bool hasBase = hasBaseLeft && currentBase == least;
+            bool hasEmbedded = embedded < embeddedCatalog.foodCount && embeddedName == least;
+            if (hasLocal)
+            {
+                const Food &food = *local->second;
+                visit(FoodListing{least, food.getType() == "composite", withCalories ? food.getCalories() : 0.0f});
+            }
+            else if (hasBase)
+            {
+                visitBase(least);
+            }
+            else
+            {
+                const EmbeddedFood &food = embeddedCatalog.foods[embedded];
+                visit(FoodListing{least, food.composite, food.calories});
+            }
+            local = hasLocal ? next(local) : local;
+            if (hasBase)
+                advanceBase();
+            embedded += hasEmbedded;
+        }
+    }
+
+    // Names of all foods, in the order listAllFoods prints them
+    vector<string> listFoodNames()
+    {
+        vector<string> names;
+        forEachFood([&](const FoodListing &food)
+                    { names.emplace_back(food.name); },
+                    false);
+        return names;
+    }
+
+    void listAllFoods()
+    {
+        materializeAll();
+        cout << "\n=== All Foods in Database (" << foodCount() << ") ===" << endl;
+        forEachFood([](const FoodListing &food)
+                    { cout << food.name << " (" << (food.composite ? "composite" : "basic") << ") - " << food.calories << " calories" << endl; });
+        cout << "===========================" << endl;
+    }
+
+    // Serves the catalog from a snapshot shared by all processes on the host;
+    // takes effect on the next loadDatabase
+    void setSharedCatalog(bool shared)
+    {
+        sharedMode = shared;
+    }
+
+    // Splits the catalog into `count` shard files read on demand (0 turns
+    // sharding off); takes effect on the next loadDatabase
+    void setShardCount(uint32_t count)
+    {
+        requestedShards = count;
+    }
+
+    bool isModified() const
+    {
+        return modified;
+    }
+
+    void setCompactJson(bool compact)
+    {
+        jsonIndent = compact ? -1 : 4;
+    }
+};
+
+// Versioned binary record files: memory-mapped mirrors of the JSON data files.
+//
+// Layout (native byte order): Header, a table of Section descriptors, then
+// each section's fixed-size records. The last section is the string table,
+// referenced by StringRef. Views read fields in place, so nothing is
+// deserialized. The header names the JSON file the mirror was built from; a
+// stale or damaged mirror is ignored and the JSON is read instead.
+//
+// Schema evolution: new fields are only ever appended to a record, and each
+// section records its record size, so a reader accepts any file whose records
+// are at least as large as the ones it knows. Incompatible changes get a new
+// magic.
+class RecordFile
+{
+public:
+    static constexpr uint32_t SCHEMA_VERSION = 1;
+
+    enum Kind : uint32_t
+    {
+        DIARY = 1,
+        PROFILE = 2
+    };
+
+    struct StringRef
+    {
+        uint32_t offset;
+        uint32_t length;
+    };
+
+    template <typename T>
+    static T read(const char *at)
+    {
+        T value;
+        memcpy(&value, at, sizeof(T));
+        return value;
+    }
+
+private:
+    static constexpr char MAGIC[8] = {'D', 'M', 'R', 'E', 'C', '\0', '\0', '\0'};
+
+    struct Header
+    {
+        char magic[8];
+        uint32_t schemaVersion;
+        uint32_t kind;
+        uint64_t sourceSize;
+        int64_t sourceMtimeNs;
+        uint32_t payloadCrc; // everything after the header
+        uint32_t sectionCount;
+    };
+
+    struct Section
+    {
+        uint64_t offset;
+        uint64_t count;
+        uint32_t recordSize;
+        uint32_t reserved;
+    };
+
+    MappedFile mapped;
+    vector<Section> sections;
+
+public:
+    // Accumulates the sections of a record file; the last one is the string table
+    class Builder
+    {
+    private:
+        vector<string> data;
+        vector<uint32_t> recordSizes;
+        unordered_map<string, StringRef> interned;
+
+    public:
+        explicit Builder(vector<uint32_t> sizes) : data(sizes.size() + 1), recordSizes(move(sizes))
+        {
+            recordSizes.push_back(1);
+        }
+
+        template <typename T>
+        void add(size_t section, const T &record)
+        {
+            data[section].append(reinterpret_cast<const char *>(&record), sizeof(T));
+        }
+
+        StringRef intern(string_view text)
+        {
+            auto it = interned.find(string(text));
+            if (it != interned.end())
+                return it->second;
+            string &strings = data.back();
+            StringRef ref{static_cast<uint32_t>(strings.size()), static_cast<uint32_t>(text.size())};
+            strings.append(text);
+            interned.emplace(string(text), ref);
+            return ref;
+        }
+
+        size_t count(size_t section) const
+        {
+            return data[section].size() / recordSizes[section];
+        }
+
+        // Writes to a per-process temporary file and renames it into place
+        bool write(const string &path, Kind kind, const FileStamp &source) const
+        {
+            vector<Section> table(data.size());
+            uint64_t offset = sizeof(Header) + table.size() * sizeof(Section);
+            for (size_t i = 0; i < data.size(); ++i)
+            {
+                table[i] = Section{offset, data[i].size() / recordSizes[i], recordSizes[i], 0};
+                offset += data[i].size();
+            }
+
+            Header header{};
+            memcpy(header.magic, MAGIC, sizeof(MAGIC));
+            header.schemaVersion = SCHEMA_VERSION;
+            header.kind = kind;
+            header.sourceSize = source.size;
+            header.sourceMtimeNs = source.mtimeNs;
+            header.sectionCount = static_cast<uint32_t>(table.size());
+            header.payloadCrc = Crc32c::compute(table.data(), table.size() * sizeof(Section));
+            for (const auto &section : data)
+                header.payloadCrc = Crc32c::extend(header.payloadCrc, section.data(), section.size());
+
+            string tempPath = path + ".tmp." + to_string(::getpid());
+            {
+                ofstream file(tempPath, ios::binary | ios::trunc);
+                if (!file.is_open())
+                    return false;
+                file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+                file.write(reinterpret_cast<const char *>(table.data()), table.size() * sizeof(Section));
+                for (const auto &section : data)
+                    file.write(section.data(), section.size());
+                if (!file.good())
+                {
+                    file.close();
+                    ::remove(tempPath.c_str());
+                    return false;
+                }
+            }
+            if (::rename(tempPath.c_str(), path.c_str()) != 0)
+            {
+                ::remove(tempPath.c_str());
+                return false;
+            }
+            return true;
+        }
+    };
+
+    // Maps `path` if it is a `kind` mirror of `source` with at least as many
+    // sections as `recordSizes` (string table excluded) and records at least that large
+    bool open(const string &path, Kind kind, const FileStamp &source, const vector<uint32_t> &recordSizes)
+    {
+        sections.clear();
+        if (!mapped.map(path) || mapped.size() < sizeof(Header))
+            return false;
+
+        Header header;
+        memcpy(&header, mapped.begin(), sizeof(header));
+        if (memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 || header.schemaVersion == 0 || header.kind != kind ||
+            header.sourceSize != source.size || header.sourceMtimeNs != source.mtimeNs ||
+            header.sectionCount < recordSizes.size() + 1 ||
+            sizeof(Header) + uint64_t(header.sectionCount) * sizeof(Section) > mapped.size())
+            return false;
+        if (Crc32c::compute(mapped.begin() + sizeof(Header), mapped.size() - sizeof(Header)) != header.payloadCrc)
+            return false;
+
+        sections.resize(header.sectionCount);
+        memcpy(sections.data(), mapped.begin() + sizeof(Header), sections.size() * sizeof(Section));
+        for (size_t i = 0; i < sections.size(); ++i)
+        {
+            const Section &section = sections[i];
+            uint32_t minimum = i < recordSizes.size() ? recordSizes[i] : 1;
+            if (section.recordSize < minimum ||
+                section.offset + section.count * section.recordSize > mapped.size())
+            {
+                sections.clear();
+                return false;
+            }
+        }
+        // Whatever sections a newer writer added, the string table is last
+        return true;
+    }
+
+    size_t count(size_t section) const
+    {
+        return sections[section].count;
+    }
+
+    const char *record(size_t section, size_t index) const
+    {
+        return mapped.begin() + sections[section].offset + index * sections[section].recordSize;
+    }
+
+    // Text from the string table; references out of range read as empty
+    string_view text(StringRef ref) const
+    {
+        const Section &strings = sections.back();
+        if (uint64_t(ref.offset) + ref.length > strings.count)
+            return string_view();
+        return string_view(mapped.begin() + strings.offset + ref.offset, ref.length);
+    }
+};
+
+// Food log entry for a specific day
+class FoodEntry
+{
+public:
+    string foodName;
+    double servings;
+    double calories;
+
+    FoodEntry(const string &name, double servs, double cals)
+        : foodName(name), servings(servs), calories(cals) {}
+
+    // Binary form in a diary mirror (schema version 1)
+    struct Record
+    {
+        RecordFile::StringRef food;
+        double servings;
+        double calories;
+    };
+
+    // Read-only entry in a mapped diary mirror
+    class View
+    {
+    private:
+        const RecordFile *file;
+        const char *record;
+
+    public:
+        View(const RecordFile &f, const char *r) : file(&f), record(r) {}
+
+        string_view foodName() const { return file->text(RecordFile::read<RecordFile::StringRef>(record + offsetof(Record, food))); }
+        double servings() const { return RecordFile::read<double>(record + offsetof(Record, servings)); }
+        double calories() const { return RecordFile::read<double>(record + offsetof(Record, calories)); }
+
+        void writeJson(JsonStreamWriter &writer) const
+        {
+            FoodEntry::writeJson(writer, foodName(), servings(), calories());
+        }
+    };
+
+    static void writeJson(JsonStreamWriter &writer, string_view foodName, double servings, double calories)
+    {
+        writer.beginObject();
+        writer.key("calories").value(calories);
+        writer.key("food").value(foodName);
+        writer.key("servings").value(servings);
+        writer.endObject();
+    }
+
+    void writeJson(JsonStreamWriter &writer) const
+    {
+        writeJson(writer, foodName, servings, calories);
+    }
+};
+
+// Date handling utility
+class DateUtil
+{
+public:
+    static string getCurrentDate()
+    {
+        auto now = chrono::system_clock::now();
+        auto time = chrono::system_clock::to_time_t(now);
+        tm tm = *localtime(&time);
+
+        stringstream ss;
+        ss << put_time(&tm, "%Y-%m-%d");
+        return ss.str();
+    }
+
+    static bool isValidDate(const string &dateStr)
+    {
+        if (dateStr.length() != 10)
+            return false;
+
+        // Check format: YYYY-MM-DD
+        for (int i = 0; i < 10; i++)
+        {
+            if ((i == 4 || i == 7) && dateStr[i] != '-')
+                return false;
+            else if (i != 4 && i != 7 && !isdigit(dateStr[i]))
+                return false;
+        }
+
+        int year = stoi(dateStr.substr(0, 4));
+        int month = stoi(dateStr.substr(5, 2));
+        int day = stoi(dateStr.substr(8, 2));
+
+        if (month < 1 || month > 12)
+            return false;
+
+        int daysInMonth[] = {0, 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+
+        // Adjust for leap year
+        if (month == 2 && ((year % 4 == 0 && year % 100 != 0) || year % 400 == 0))
+        {
+            daysInMonth[2] = 29;
+        }
+
+        return day >= 1 && day <= daysInMonth[month];
+    }
+
+    // Days since 1970-01-01 of a valid YYYY-MM-DD date
+    static bool toDayNumber(const string &dateStr, int32_t &dayNumber)
+    {
+        if (!isValidDate(dateStr))
+            return false;
+        int year = stoi(dateStr.substr(0, 4));
+        unsigned month = stoi(dateStr.substr(5, 2));
+        unsigned day = stoi(dateStr.substr(8, 2));
+
+        // Civil calendar in 400-year eras starting in March
+        year -= month <= 2;
+        int era = (year >= 0 ? year : year - 399) / 400;
+        unsigned yearOfEra = static_cast<unsigned>(year - era * 400);
+        unsigned dayOfYear = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+        unsigned dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+        dayNumber = era * 146097 + static_cast<int32_t>(dayOfEra) - 719468;
+        return true;
+    }
+
+    static string fromDayNumber(int32_t dayNumber)
+    {
+        int32_t z = dayNumber + 719468;
+        int era = (z >= 0 ? z : z - 146096) / 146097;
+        unsigned dayOfEra = static_cast<unsigned>(z - era * 146097);
+        unsigned yearOfEra = (dayOfEra - dayOfEra / 1460 + dayOfEra / 36524 - dayOfEra / 146096) / 365;
+        unsigned dayOfYear = dayOfEra - (365 * yearOfEra + yearOfEra / 4 - yearOfEra / 100);
+        unsigned shiftedMonth = (5 * dayOfYear + 2) / 153;
+        unsigned day = dayOfYear - (153 * shiftedMonth + 2) / 5 + 1;
+        unsigned month = shiftedMonth < 10 ? shiftedMonth + 3 : shiftedMonth - 9;
+        int year = static_cast<int>(yearOfEra) + era * 400 + (month <= 2);
+
+        char text[32];
+        snprintf(text, sizeof(text), "%04d-%02u-%02u", year, month, day);
+        return text;
+    }
+};
+
+// Variable-length integers: 7 bits per byte, low groups first
+class Varint
+{
+public:
+    static void put(string &out, uint64_t value)
+    {
+        while (value >= 0x80)
+        {
+            out += static_cast<char>((value & 0x7f) | 0x80);
+            value >>= 7;
+        }
+        out += static_cast<char>(value);
+    }
+
+    // Advances `at`; throws on a value running past `end`
+    static uint64_t get(const char *&at, const char *end)
+    {
+        uint64_t value = 0;
+        for (int shift = 0; shift < 64; shift += 7)
+        {
+            if (at == end)
+                throw runtime_error("truncated varint");
+            uint8_t byte = static_cast<uint8_t>(*at++);
+            value |= uint64_t(byte & 0x7f) << shift;
+            if (!(byte & 0x80))
+                return value;
+        }
+        throw runtime_error("overlong varint");
+    }
+
+    static uint64_t zigzag(int64_t value) { return (uint64_t(value) << 1) ^ uint64_t(value >> 63); }
+    static int64_t unzigzag(uint64_t value) { return int64_t(value >> 1) ^ -int64_t(value & 1); }
+};
+
+// Small LZ77 block compressor. A block is a series of sequences: varint
+// literal count, the literals, then varint match length (0 ends the block)
+// and varint distance back into the output. Matches are found through a hash
+// of the next 4 bytes over a 64 KiB window.
+class LzCompressor
+{
+private:
+    static constexpr size_t MIN_MATCH = 4;
+    static constexpr size_t WINDOW = 1 << 16;
+    static constexpr int HASH_BITS = 14;
+
+    static uint32_t hashAt(const char *at)
+    {
+        uint32_t word;
+        memcpy(&word, at, sizeof(word));
+        return (word * 2654435761u) >> (32 - HASH_BITS);
+    }
+
+public:
+    static string compress(string_view input)
+    {
+        string out;
+        out.reserve(input.size() / 2 + 16);
+        vector<int64_t> table(size_t(1) << HASH_BITS, -1);
+        const char *base = input.data();
+        size_t literalStart = 0, position = 0;
+        while (position + MIN_MATCH <= input.size())
+        {
+            uint32_t h = hashAt(base + position);
+            int64_t candidate = table[h];
+            table[h] = static_cast<int64_t>(position);
+            if (candidate < 0 || position - candidate > WINDOW || memcmp(base + candidate, base + position, MIN_MATCH) != 0)
+            {
+                ++position;
+                continue;
+            }
+
+            size_t length = MIN_MATCH;
+            while (position + length < input.size() && base[candidate + length] == base[position + length])
+                ++length;
+            Varint::put(out, position - literalStart);
+            out.append(base + literalStart, position - literalStart);
+            Varint::put(out, length);
+            Varint::put(out, position - candidate);
+            position += length;
+            literalStart = position;
+        }
+        Varint::put(out, input.size() - literalStart);
+        out.append(base + literalStart, input.size() - literalStart);
+        Varint::put(out, 0);
+        return out;
+    }
+
+    // Throws if the block is malformed or does not expand to `size` bytes
+    static string decompress(string_view block, size_t size)
+    {
+        string out;
+        out.reserve(size);
+        const char *at = block.data(), *end = at + block.size();
+        while (true)
+        {
+            uint64_t literals = Varint::get(at, end);
+            if (literals > uint64_t(end - at) || out.size() + literals > size)
+                throw runtime_error("corrupt compressed block");
+            out.append(at, literals);
+            at += literals;
+
+            uint64_t length = Varint::get(at, end);
+            if (length == 0)
+                break;
+            uint64_t distance = Varint::get(at, end);
+            if (distance == 0 || distance > out.size() || out.size() + length > size)
+                throw runtime_error("corrupt compressed block");
+            // Byte by byte: a match may overlap the bytes it produces
+            size_t from = out.size() - distance;
+            for (uint64_t i = 0; i < length; ++i)
+                out += out[from + i];
+        }
+        if (out.size() != size || at != end)
+            throw runtime_error("corrupt compressed block");
+        return out;
+    }
+};
+
+// Cold storage for old diary days (food_log.json.archive).
+//
+// Layout: Header, compressed blocks, a food name dictionary, then the block
+// index. Within a block each day is the varint gap from the previous day
+// number, its entry count, and per entry the varint id of the food name,
+// servings and calories. Values that are exact in thousandths are stored as
+// zigzag varints of that fixed-point value; others as tag 1 + the raw double.
+// Blocks are decoded only when a day inside them is read.
+class DiaryArchive
+{
+public:
+    static constexpr uint32_t VERSION = 1;
+
+    struct Entry
+    {
+        uint32_t food;
+        double servings;
+        double calories;
+    };
+
+    struct Day
+    {
+        int32_t day;
+        vector<Entry> entries;
+    };
+
+private:
+    static constexpr char MAGIC[8] = {'D', 'M', 'A', 'R', 'C', 'H', '\0', '\0'};
+    static constexpr size_t BLOCK_BYTES = 32 * 1024;
+
+    struct Header
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t blockCount;
+        uint32_t foodCount;
+        uint32_t reserved;
+        uint64_t dictionaryOffset;
+        uint64_t indexOffset;
+    };
+
+    struct BlockIndex
+    {
+        int32_t firstDay;
+        int32_t lastDay;
+        uint64_t offset;
+        uint32_t compressedSize;
+        uint32_t rawSize;
+        uint32_t dayCount;
+        uint32_t crc; // of the compressed bytes
+    };
+
+    MappedFile mapped;
+    vector<BlockIndex> blocks;
+    vector<string_view> foodNames;
+
+    static void putValue(string &out, double value)
+    {
+        double scaled = nearbyint(value * 1000.0);
+        if (fabs(scaled) < 9.0e15 && scaled / 1000.0 == value)
+        {
+            Varint::put(out, Varint::zigzag(static_cast<int64_t>(scaled)) << 1);
+            return;
+        }
+        Varint::put(out, 1);
+        char raw[sizeof(double)];
+        memcpy(raw, &value, sizeof(raw));
+        out.append(raw, sizeof(raw));
+    }
+
+    static double getValue(const char *&at, const char *end)
+    {
+        uint64_t tagged = Varint::get(at, end);
+        if (!(tagged & 1))
+            return static_cast<double>(Varint::unzigzag(tagged >> 1)) / 1000.0;
+        if (tagged != 1 || end - at < static_cast<ptrdiff_t>(sizeof(double)))
+            throw runtime_error("corrupt archived value");
+        double value;
+        memcpy(&value, at, sizeof(value));
+        at += sizeof(value);
+        return value;
+    }
+
+public:
+    // Maps the archive at `path`; false if it is missing or malformed
+    bool open(const string &path)
+    {
+        blocks.clear();
+        foodNames.clear();
+        if (!mapped.map(path) || mapped.size() < sizeof(Header))
+            return false;
+
+        Header header;
+        memcpy(&header, mapped.begin(), sizeof(header));
+        if (memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 || header.version != VERSION ||
+            header.dictionaryOffset > header.indexOffset || header.indexOffset > mapped.size() ||
+            (mapped.size() - header.indexOffset) / sizeof(BlockIndex) != header.blockCount ||
+            (mapped.size() - header.indexOffset) % sizeof(BlockIndex) != 0)
+            return false;
+
+        try
+        {
+            const char *at = mapped.begin() + header.dictionaryOffset;
+            const char *end = mapped.begin() + header.indexOffset;
+            for (uint32_t i = 0; i < header.foodCount; ++i)
+            {
+                uint64_t length = Varint::get(at, end);
+                if (length > uint64_t(end - at))
+                    return false;
+                foodNames.emplace_back(at, length);
+                at += length;
+            }
+        }
+        catch (const exception &)
+        {
+            return false;
+        }
+
+        blocks.resize(header.blockCount);
+        memcpy(blocks.data(), mapped.begin() + header.indexOffset, blocks.size() * sizeof(BlockIndex));
+        for (size_t i = 0; i < blocks.size(); ++i)
+        {
+            const BlockIndex &block = blocks[i];
+            if (block.offset < sizeof(Header) || block.offset + block.compressedSize > header.dictionaryOffset ||
+                block.firstDay > block.lastDay || (i > 0 && blocks[i - 1].lastDay >= block.firstDay))
+            {
+                blocks.clear();
+                return false;
+            }
+        }
+        return true;
+    }
+
+    size_t blockCount() const { return blocks.size(); }
+
+    size_t dayCount() const
+    {
+        size_t count = 0;
+        for (const auto &block : blocks)
+            count += block.dayCount;
+        return count;
+    }
+
+    // Block whose day range covers `day`, or -1
+    ptrdiff_t findBlock(int32_t day) const
+    {
+        auto it = lower_bound(blocks.begin(), blocks.end(), day, [](const BlockIndex &block, int32_t d)
+                              { return block.lastDay < d; });
+        return it != blocks.end() && it->firstDay <= day ? it - blocks.begin() : -1;
+    }
+
+    string_view foodName(uint32_t food) const
+    {
+        return food < foodNames.size() ? foodNames[food] : string_view();
+    }
+
+    // Decompresses and decodes one block; throws if it is damaged
+    vector<Day> decodeBlock(size_t index) const
+    {
+        const BlockIndex &block = blocks[index];
+        string_view compressed(mapped.begin() + block.offset, block.compressedSize);
+        if (Crc32c::compute(compressed.data(), compressed.size()) != block.crc)
+            throw runtime_error("checksum mismatch in archived block");
+        string raw = LzCompressor::decompress(compressed, block.rawSize);
+
+        vector<Day> days;
+        days.reserve(block.dayCount);
+        const char *at = raw.data(), *end = at + raw.size();
+        int32_t day = block.firstDay;
+        for (uint32_t d = 0; d < block.dayCount; ++d)
+        {
+            day += static_cast<int32_t>(Varint::get(at, end));
+            Day decoded{day, {}};
+            uint64_t entries = Varint::get(at, end);
+            if (entries > uint64_t(end - at))
+                throw runtime_error("corrupt archived day");
+            decoded.entries.reserve(entries);
+            for (uint64_t e = 0; e < entries; ++e)
+            {
+                uint64_t food = Varint::get(at, end);
+                if (food >= foodNames.size())
+                    throw runtime_error("unknown archived food id");
+                double servings = getValue(at, end);
+                double calories = getValue(at, end);
+                decoded.entries.push_back({static_cast<uint32_t>(food), servings, calories});
+            }
+            days.push_back(move(decoded));
+        }
+        if (at != end || day != block.lastDay)
+            throw runtime_error("corrupt archived block");
+        return days;
+    }
+
+    // Encodes `days` (by day number) into a complete archive file image
+    static string encode(const map<int32_t, vector<FoodEntry>> &days)
+    {
+        unordered_map<string_view, uint32_t> foodIds;
+        vector<string_view> dictionary;
+        vector<BlockIndex> index;
+        string body;
+
+        string raw;
+        BlockIndex block{};
+        int32_t previous = 0;
+        auto flush = [&]()
+        {
+            if (block.dayCount == 0)
+                return;
+            string compressed = LzCompressor::compress(raw);
+            block.offset = sizeof(Header) + body.size();
+            block.compressedSize = static_cast<uint32_t>(compressed.size());
+            block.rawSize = static_cast<uint32_t>(raw.size());
+            block.crc = Crc32c::compute(compressed.data(), compressed.size());
+            body += compressed;
+            index.push_back(block);
+            raw.clear();
+            block = BlockIndex{};
+        };
+
+        for (const auto &[day, entries] : days)
+        {
+            if (block.dayCount == 0)
+            {
+                block.firstDay = day;
+                previous = day;
+            }
+            Varint::put(raw, static_cast<uint64_t>(day - previous));
+            Varint::put(raw, entries.size());
+            for (const auto &entry : entries)
+            {
+                auto [it, added] = foodIds.emplace(entry.foodName, static_cast<uint32_t>(dictionary.size()));
+                if (added)
+                    dictionary.push_back(entry.foodName);
+                Varint::put(raw, it->second);
+                putValue(raw, entry.servings);
+                putValue(raw, entry.calories);
+            }
+            previous = day;
+            block.lastDay = day;
+            ++block.dayCount;
+            if (raw.size() >= BLOCK_BYTES)
+                flush();
+        }
+        flush();
+
+        Header header{};
+        memcpy(header.magic, MAGIC, sizeof(MAGIC));
+        header.version = VERSION;
+        header.blockCount = static_cast<uint32_t>(index.size());
+        header.foodCount = static_cast<uint32_t>(dictionary.size());
+        header.dictionaryOffset = sizeof(Header) + body.size();
+        for (string_view name : dictionary)
+        {
+            Varint::put(body, name.size());
+            body.append(name);
+        }
+        header.indexOffset = sizeof(Header) + body.size();
+
+        string image(reinterpret_cast<const char *>(&header), sizeof(header));
+        image += body;
+        image.append(reinterpret_cast<const char *>(index.data()), index.size() * sizeof(BlockIndex));
+        return image;
+    }
+};
+
+// Command interface for undo functionality
+class Command
+{
+public:
+    virtual ~Command() = default;
+    virtual void execute() = 0;
+    virtual void undo() = 0;
+    virtual string getDescription() const = 0;
+};
+
+// Food diary main class
+class FoodDiary
+{
+private:
+    string logFile;
+    map<string, vector<FoodEntry>> dailyLogs;
+    stack<shared_ptr<Command>> undoStack;
+    string currentDate;
+    FoodDatabaseManager &dbManager;
+    int jsonIndent = 4; // negative for compact output
+    // Entries loaded without calories, as (date, index) until the catalog is available
+    vector<pair<string, size_t>> unresolvedEntries;
+    bool loadAttempted = false; // never save over a file that was not read
+
+    // Binary mirror of the log file (food_log.json.bin). When it is current the
+    // JSON is not parsed: days are read from the mapping until one is edited,
+    // which copies it into dailyLogs and records it in faultedDates.
+    struct DayRecord
+    {
+        RecordFile::StringRef date;
+        uint32_t firstEntry;
+        uint32_t entryCount;
+    };
+    enum RecordSection : size_t
+    {
+        DAYS,
+        ENTRIES
+    };
+    shared_ptr<const RecordFile> logRecords;
+    set<string, less<>> faultedDates;
+
+    // Dates edited since the last save. A clean diary is not rewritten, unless
+    // its log file had to be parsed and so has no current mirror.
+    set<string> dirtyDates;
+    bool mirrorStale = false;
+
+    // Old days moved out of the log file into food_log.json.archive. Blocks are
+    // decoded on first read and kept; an edited archived day faults like a
+    // mirrored one and is archived again by the next save.
+    shared_ptr<const DiaryArchive> archive;
+    mutable map<size_t, vector<DiaryArchive::Day>> archivedBlocks;
+    set<string, less<>> faultedArchiveDates;
+    int archiveAfterDays = 0; // 0 never moves days out of the log file
+    string archiveSavedAt;    // cutoff of the last archive written this session
+
+    // Monthly layout: the diary lives in food_log.json.months/YYYY-MM.json
+    // instead of the log file. A month is read on first use or prefetched in
+    // the background around the current date; days edited fault into dailyLogs
+    // as above, and a save rewrites only the months holding dirty dates. The
+    // manifest is written last when converting, so a half-converted directory
+    // is never read.
+    static constexpr int MONTHS_VERSION = 1;
+    struct MonthLog
+    {
+        map<string, vector<FoodEntry>> days;
+        vector<pair<string, size_t>> unresolved;
+        string messages; // recovery notes, printed on first use
+        bool failed = false; // unreadable, so never written over
+    };
+    mutable map<string, shared_future<shared_ptr<MonthLog>>> months;
+    bool partitioned = false;     // the months are the diary
+    bool monthsRequested = false; // convert a single-file diary on the next save
+    bool convertToMonths = false;
+
+    static vector<uint32_t> recordSizes()
+    {
+        return {sizeof(DayRecord), sizeof(FoodEntry::Record)};
+    }
+
+    static DayRecord dayRecord(const RecordFile &records, size_t day)
+    {
+        return RecordFile::read<DayRecord>(records.record(DAYS, day));
+    }
+
+    // Maps the mirror if it was built from the current log file and its days
+    // are sorted and in range
+    bool attachLogRecords(const FileStamp &source)
+    {
+        auto records = make_shared<RecordFile>();
+        if (!records->open(recordsPath(), RecordFile::DIARY, source, recordSizes()))
+            return false;
+        string_view previous;
+        for (size_t day = 0; day < records->count(DAYS); ++day)
+        {
+            DayRecord record = dayRecord(*records, day);
+            string_view date = records->text(record.date);
+            if ((day > 0 && !(previous < date)) ||
+                uint64_t(record.firstEntry) + record.entryCount > records->count(ENTRIES))
+                return false;
+            previous = date;
+        }
+        logRecords = move(records);
+        return true;
+    }
+
+    // Index of `date` in the mirror, or -1
+    ptrdiff_t findDay(string_view date) const
+    {
+        size_t low = 0, high = logRecords ? logRecords->count(DAYS) : 0;
+        while (low < high)
+        {
+            size_t middle = low + (high - low) / 2;
+            if (logRecords->text(dayRecord(*logRecords, middle).date) < date)
+                low = middle + 1;
+            else
+                high = middle;
+        }
+        if (logRecords && low < logRecords->count(DAYS) && logRecords->text(dayRecord(*logRecords, low).date) == date)
+            return static_cast<ptrdiff_t>(low);
+        return -1;
+    }
+
+    // The archived day for `date`, decoding its block on first use
+    const DiaryArchive::Day *archivedDay(const string &date) const
+    {
+        int32_t dayNumber;
+        if (!archive || !DateUtil::toDayNumber(date, dayNumber))
+            return nullptr;
+        ptrdiff_t block = archive->findBlock(dayNumber);
+        if (block < 0)
+            return nullptr;
+
+        auto cached = archivedBlocks.find(block);
+        if (cached == archivedBlocks.end())
+        {
+            vector<DiaryArchive::Day> days;
+            try
+            {
+                days = archive->decodeBlock(block);
+            }
+            catch (const exception &e)
+            {
+                cerr << "Warning: Unable to read archived diary days: " << e.what() << endl;
+            }
+            cached = archivedBlocks.emplace(block, move(days)).first;
+        }
+        const auto &days = cached->second;
+        auto it = lower_bound(days.begin(), days.end(), dayNumber, [](const DiaryArchive::Day &day, int32_t d)
+                              { return day.day < d; });
+        return it != days.end() && it->day == dayNumber ? &*it : nullptr;
+    }
+
+    // Calls visit(food, servings, calories) for each entry of `date`, in log
+    // order: edited days first, then the mirror, read in place, then the
+    // month files, then the archive
+    template <typename Fn>
+    void forEachEntry(const string &date, Fn visit) const
+    {
+        auto it = dailyLogs.find(date);
+        if (it != dailyLogs.end())
+        {
+            for (const auto &entry : it->second)
+                visit(string_view(entry.foodName), entry.servings, entry.calories);
+            return;
+        }
+        if (faultedDates.count(date))
+            return;
+        ptrdiff_t day = findDay(date);
+        if (day >= 0)
+        {
+            DayRecord record = dayRecord(*logRecords, day);
+            for (uint32_t i = 0; i < record.entryCount; ++i)
+            {
+                FoodEntry::View entry(*logRecords, logRecords->record(ENTRIES, record.firstEntry + i));
+                visit(entry.foodName(), entry.servings(), entry.calories());
+            }
+            return;
+        }
+        if (partitioned)
+        {
+            const MonthLog &month = monthLog(monthOf(date));
+            auto saved = month.days.find(date);
+            if (saved != month.days.end())
+            {
+                for (const auto &entry : saved->second)
+                    visit(string_view(entry.foodName), entry.servings, entry.calories);
+                return;
+            }
+        }
+        if (const DiaryArchive::Day *archived = archivedDay(date))
+        {
+            for (const auto &entry : archived->entries)
+                visit(archive->foodName(entry.food), entry.servings, entry.calories);
+        }
+    }
+
+    // Calls visit(date, entryCount, forEntries) for every day the log file will
+    // hold, in date order; forEntries(fn) calls fn(food, servings, calories)
+    template <typename Fn>
+    static void forEachSavedDay(const map<string, vector<FoodEntry>> &logs, const RecordFile *records,
+                                const set<string, less<>> &faulted, Fn visit)
+    {
+        size_t day = 0, days = records ? records->count(DAYS) : 0;
+        auto log = logs.begin();
+        while (log != logs.end() || day < days)
+        {
+            string_view mirrored = day < days ? records->text(dayRecord(*records, day).date) : string_view();
+            if (day < days && (log == logs.end() || mirrored < log->first))
+            {
+                if (!faulted.count(mirrored))
+                {
+                    DayRecord record = dayRecord(*records, day);
+                    visit(mirrored, size_t(record.entryCount), [&](auto entry)
+                          {
+                        for (uint32_t i = 0; i < record.entryCount; ++i)
+                        {
+                            FoodEntry::View view(*records, records->record(ENTRIES, record.firstEntry + i));
+                            entry(view.foodName(), view.servings(), view.calories());
+                        } });
+                }
+                ++day;
+                continue;
+            }
+
+            const vector<FoodEntry> &entries = log->second;
+            visit(string_view(log->first), entries.size(), [&](auto entry)
+                  {
+                for (const auto &logged : entries)
+                    entry(string_view(logged.foodName), logged.servings, logged.calories); });
+            day += day < days && mirrored == log->first;
+            ++log;
+        }
+    }
+
+    // Days older than this are moved into the archive on save, or "" when archiving is off
+    string archiveCutoff() const
+    {
+        int32_t today;
+        if (archiveAfterDays <= 0 || partitioned || convertToMonths || !DateUtil::toDayNumber(DateUtil::getCurrentDate(), today))
+            return "";
+        return DateUtil::fromDayNumber(today - archiveAfterDays);
+    }
+
+    // Whether the next save must rewrite the archive
+    bool archiveDue() const
+    {
+        // Converting to months takes the archived days along
+        if (partitioned || convertToMonths)
+            return false;
+        if (!faultedArchiveDates.empty())
+            return true;
+        string cutoff = archiveCutoff();
+        if (cutoff.empty() || cutoff == archiveSavedAt)
+            return false;
+        bool oldLogged = !dailyLogs.empty() && dailyLogs.begin()->first < cutoff;
+        bool oldMirrored = logRecords && logRecords->count(DAYS) > 0 && logRecords->text(dayRecord(*logRecords, 0).date) < cutoff;
+        return oldLogged || oldMirrored;
+    }
+
+    size_t entryCount(const string &date) const
+    {
+        size_t count = 0;
+        forEachEntry(date, [&](string_view, double, double)
+                     { ++count; });
+        return count;
+    }
+
+    // Copies a mirrored, archived or monthly day into dailyLogs before it is edited
+    void materializeDate(const string &date)
+    {
+        if ((!logRecords && !archive && !partitioned) || faultedDates.count(date) || dailyLogs.count(date))
+            return;
+        bool mirrored = findDay(date) >= 0;
+        bool archived = !mirrored && archivedDay(date);
+        bool monthly = !mirrored && !archived && partitioned && monthLog(monthOf(date)).days.count(date);
+        if (mirrored || archived || monthly)
+        {
+            vector<FoodEntry> entries;
+            forEachEntry(date, [&](string_view food, double servings, double calories)
+                         { entries.emplace_back(string(food), servings, calories); });
+            dailyLogs[date] = move(entries);
+        }
+        if (archived)
+            faultedArchiveDates.insert(date);
+        faultedDates.insert(date);
+    }
+
+    // The log of `date`, ready to be edited
+    vector<FoodEntry> &logFor(const string &date)
+    {
+        materializeDate(date);
+        dirtyDates.insert(date);
+        return dailyLogs[date];
+    }
+
+    string monthsDirectory() const
+    {
+        return logFile + ".months";
+    }
+
+    string monthPath(const string &month) const
+    {
+        return monthsDirectory() + "/" + month + ".json";
+    }
+
+    string monthsManifestPath() const
+    {
+        return monthsDirectory() + "/manifest.json";
+    }
+
+    // "YYYY-MM"; keys that are not dates share one file
+    static string monthOf(const string &date)
+    {
+        return DateUtil::isValidDate(date) ? date.substr(0, 7) : "undated";
+    }
+
+    static shared_ptr<MonthLog> loadMonth(const string &path)
+    {
+        auto log = make_shared<MonthLog>();
+        ostringstream messages;
+        try
+        {
+            DataIntegrity::recover(path, messages);
+            if (ifstream(path).is_open())
+                readLogFile(path, log->days, log->unresolved);
+        }
+        catch (const exception &e)
+        {
+            log->days.clear();
+            log->unresolved.clear();
+            log->failed = true;
+            messages << "Error loading logs from " << path << ": " << e.what() << endl;
+        }
+        log->messages = messages.str();
+        return log;
+    }
+
+    // The month's saved days, loading them now unless a prefetch did
+    const MonthLog &monthLog(const string &month) const
+    {
+        auto it = months.find(month);
+        if (it == months.end())
+            it = months.emplace(month, async(launch::deferred, loadMonth, monthPath(month)).share()).first;
+        const shared_ptr<MonthLog> &log = it->second.get();
+        cout << log->messages;
+        log->messages.clear();
+
+        // Entries without calories are priced from the catalog on first use
+        for (const auto &[date, index] : log->unresolved)
+        {
+            FoodEntry &entry = log->days[date][index];
+            if (auto food = dbManager.getFood(entry.foodName))
+                entry.calories = food->getCalories() * entry.servings;
+        }
+        log->unresolved.clear();
+        return *log;
+    }
+
+    // Starts loading the month of `date` and the months either side of it
+    void prefetchAround(const string &date)
+    {
+        if (!partitioned || !DateUtil::isValidDate(date))
+            return;
+        int year = stoi(date.substr(0, 4));
+        int month = stoi(date.substr(5, 2));
+        for (int offset : {0, -1, 1})
+        {
+            int y = year + (month + offset > 12) - (month + offset < 1);
+            int m = (month + offset + 11) % 12 + 1;
+            char name[32];
+            snprintf(name, sizeof(name), "%04d-%02d", y, m);
+            if (!months.count(name))
+                months.emplace(name, async(launch::async, loadMonth, monthPath(name)).share());
+        }
+    }
+
+    // Queues every month holding a dirty date (all of them when converting)
+    // as one batch. Days not edited are copied from the month's file.
+    vector<future<PersistResult>> saveMonthsAsync()
+    {
+        map<string, map<string, vector<FoodEntry>>> contents;
+        if (convertToMonths)
+        {
+            forEachSavedDay(dailyLogs, logRecords.get(), faultedDates, [&](string_view date, size_t count, auto forEntries)
+                            {
+                vector<FoodEntry> &entries = contents[monthOf(string(date))][string(date)];
+                entries.reserve(count);
+                forEntries([&](string_view food, double servings, double calories)
+                           { entries.emplace_back(string(food), servings, calories); }); });
+            // Archived days, unless edited (or emptied) this session
+            for (size_t block = 0; archive && block < archive->blockCount(); ++block)
+            {
+                for (const auto &day : archive->decodeBlock(block))
+                {
+                    string date = DateUtil::fromDayNumber(day.day);
+                    auto &days = contents[monthOf(date)];
+                    if (faultedArchiveDates.count(date) || days.count(date))
+                        continue;
+                    vector<FoodEntry> &entries = days[date];
+                    for (const auto &entry : day.entries)
+                        entries.emplace_back(string(archive->foodName(entry.food)), entry.servings, entry.calories);
+                }
+            }
+        }
+        else
+        {
+            for (const string &date : dirtyDates)
+            {
+                string month = monthOf(date);
+                if (contents.count(month))
+                    continue;
+                const MonthLog &saved = monthLog(month);
+                if (saved.failed)
+                {
+                    cerr << "Warning: Not saving " << monthPath(month) << " because it could not be read." << endl;
+                    continue;
+                }
+                auto &days = contents[month];
+                for (const auto &[day, entries] : saved.days)
+                {
+                    if (!faultedDates.count(day))
+                        days.emplace(day, entries);
+                }
+            }
+            for (const auto &[date, entries] : dailyLogs)
+            {
+                auto month = contents.find(monthOf(date));
+                if (month != contents.end())
+                    month->second[date] = entries;
+            }
+        }
+
+        ::mkdir(monthsDirectory().c_str(), 0755);
+        PersistenceWorker::Batch batch;
+        vector<future<PersistResult>> saves;
+        for (auto &[month, days] : contents)
+        {
+            saves.push_back(PersistenceWorker::instance().submit(monthPath(month), [days = move(days), indent = jsonIndent]()
+                                                                 {
+                JsonStreamWriter writer(indent);
+                writer.beginObject();
+                for (const auto &[date, entries] : days)
+                {
+                    writer.key(date).beginArray();
+                    for (const auto &entry : entries)
+                        entry.writeJson(writer);
+                    writer.endArray();
+                }
+                writer.endObject();
+                return writer.take(); }));
+        }
+        return saves;
+    }
+
+    string recordsPath() const
+    {
+        return logFile + ".bin";
+    }
 
-// Food diary main class
-class FoodDiary
-{
-private:
-    string logFile;
-    map<string, vector<FoodEntry>> dailyLogs;
-    stack<shared_ptr<Command>> undoStack;
-    string currentDate;
-    FoodDatabaseManager &dbManager;
+    string archivePath() const
+    {
+        return logFile + ".archive";
+    }
 
 public:
-    FoodDiary(FoodDatabaseManager &db, const string &log)
+    // With deferLoad the owner calls loadLogs itself, e.g. alongside the other stores
+    FoodDiary(FoodDatabaseManager &db, const string &log, bool deferLoad = false)
         : dbManager(db), logFile(log), currentDate(DateUtil::getCurrentDate())
     {
-        loadLogs();
+        if (!deferLoad)
+        {
+            loadLogs();
+        }
     }
 
     ~FoodDiary()
     {
-        saveLogs();
+        if (loadAttempted)
+        {
+            saveLogs();
+        }
     }
 
-    // Log operations
-    void loadLogs()
+    // Log operations. Only touches the diary's own state, so it may run on a
+    // loader thread; messages go to the given streams.
+    void loadLogs(ostream &out = cout, ostream &err = cerr)
     {
+        loadAttempted = true;
         try
         {
+            DataIntegrity::recover(monthsManifestPath(), out);
+            ifstream manifest(monthsManifestPath());
+            if (manifest.is_open())
+            {
+                partitioned = true;
+                json j;
+                manifest >> j;
+                if (j.at("version") != MONTHS_VERSION)
+                {
+                    loadAttempted = false;
+                    throw runtime_error("unsupported version in " + monthsManifestPath());
+                }
+                if (archiveAfterDays)
+                {
+                    err << "Warning: Logs stored by month are not archived." << endl;
+                    archiveAfterDays = 0;
+                }
+                prefetchAround(currentDate);
+                out << "Food logs are stored by month in " << monthsDirectory() << "." << endl;
+                return;
+            }
+            convertToMonths = monthsRequested;
+
+            DataIntegrity::recover(archivePath(), out);
+            auto archived = make_shared<DiaryArchive>();
+            if (archived->open(archivePath()))
+            {
+                archive = move(archived);
+                out << "Found " << archive->dayCount() << " archived days in " << archive->blockCount() << " blocks." << endl;
+            }
+            else if (ifstream(archivePath()).is_open())
+            {
+                err << "Warning: Ignoring unreadable diary archive " << archivePath() << endl;
+            }
+
+            DataIntegrity::recover(logFile, out);
+            FileStamp source;
+            if (FileStamp::of(logFile, source) && attachLogRecords(source))
+            {
+                out << "Loaded food logs for " << logRecords->count(DAYS) << " days." << endl;
+                return;
+            }
+
             ifstream file(logFile);
             if (!file.is_open())
             {
-                cout << "No existing log file found. Creating a new one." << endl;
+                out << "No existing log file found. Creating a new one." << endl;
                 return;
             }
 
-            json j;
-            file >> j;
             file.close();
+            readLogFile(logFile, dailyLogs, unresolvedEntries);
+            mirrorStale = true;
+            out << "Loaded food logs for " << dailyLogs.size() << " days." << endl;
+        }
+        catch (const exception &e)
+        {
+            err << "Error loading logs: " << e.what() << endl;
+        }
+    }
 
-            for (auto &[date, entries] : j.items())
+    // Reads a log file into `logs`; entries without calories are listed in
+    // `unresolved` as (date, index) to be priced from the catalog later
+    static void readLogFile(const string &path, map<string, vector<FoodEntry>> &logs, vector<pair<string, size_t>> &unresolved)
+    {
+        MappedFile mapped;
+        if (mapped.map(path) && parseLogsFast(mapped.begin(), mapped.size(), logs, unresolved))
+            return;
+
+        ifstream file(path);
+        json j;
+        file >> j;
+        for (auto &[date, entries] : j.items())
+        {
+            vector<FoodEntry> &log = logs[date];
+            for (const auto &entry : entries)
             {
-                for (const auto &entry : entries)
+                string foodName = entry.at("food");
+                double servings = entry.at("servings");
+                auto calories = entry.find("calories");
+                if (calories == entry.end() || calories->is_null())
+                {
+                    unresolved.emplace_back(date, log.size());
+                    log.emplace_back(foodName, servings, 0.0);
+                }
+                else
                 {
-                    string foodName = entry["food"];
-                    double servings = entry["servings"];
-                    double calories = entry["calories"];
-                    dailyLogs[date].emplace_back(foodName, servings, calories);
+                    log.emplace_back(foodName, servings, calories->get<double>());
                 }
             }
+        }
+    }
 
-            cout << "Loaded food logs for " << dailyLogs.size() << " days." << endl;
+    // Fast path for a log file in the shape saveLogs writes; false (with the
+    // logs untouched) if it must be read through nlohmann instead
+    static bool parseLogsFast(const char *data, size_t size, map<string, vector<FoodEntry>> &logs,
+                              vector<pair<string, size_t>> &unresolved)
+    {
+        map<string, vector<FoodEntry>> parsed;
+        vector<pair<string, size_t>> pending;
+        try
+        {
+            FastJsonReader reader(data, data + size);
+            reader.readObject([&](const string &date)
+                              {
+                auto [day, added] = parsed.try_emplace(date);
+                if (!added)
+                    throw FastJsonReader::Miss();
+                vector<FoodEntry> &log = day->second;
+                reader.readArray([&]()
+                                 {
+                    string foodName;
+                    double servings = 0.0, calories = 0.0;
+                    bool priced = false;
+                    unsigned seen = 0;
+                    reader.readObject([&](const string &key)
+                                      {
+                        unsigned bit = key == "food" ? 1 : key == "servings" ? 2 : key == "calories" ? 4 : 0;
+                        if (bit == 0 || (seen & bit))
+                            throw FastJsonReader::Miss();
+                        seen |= bit;
+                        if (bit == 1)
+                        {
+                            foodName = reader.readString();
+                        }
+                        else if (bit == 2)
+                        {
+                            servings = reader.readNumber();
+                        }
+                        else if (!reader.readNull())
+                        {
+                            calories = reader.readNumber();
+                            priced = true;
+                        } });
+                    if ((seen & 3) != 3)
+                        throw FastJsonReader::Miss();
+                    // Entries without calories are priced from the catalog later
+                    if (!priced)
+                        pending.emplace_back(date, log.size());
+                    log.emplace_back(foodName, servings, calories); }); });
+            if (!reader.atEnd())
+                return false;
         }
-        catch (const exception &e)
+        catch (const FastJsonReader::Miss &)
         {
-            cerr << "Error loading logs: " << e.what() << endl;
+            return false;
         }
+        logs = move(parsed);
+        unresolved = move(pending);
+        return true;
     }
 
-    void saveLogs()
+    // Fills in calories of entries loaded without them; call once the catalog is loaded
+    void resolvePendingCalories()
     {
-        try
+        size_t missing = 0;
+        for (const auto &[date, index] : unresolvedEntries)
         {
-            json j;
+            FoodEntry &entry = dailyLogs[date][index];
+            dirtyDates.insert(date);
+            if (auto food = dbManager.getFood(entry.foodName))
+                entry.calories = food->getCalories() * entry.servings;
+            else
+                ++missing;
+        }
+        if (missing)
+            cout << "Warning: " << missing << " log entr" << (missing == 1 ? "y references an unknown food" : "ies reference unknown foods")
+                 << " and count as 0 calories." << endl;
+        unresolvedEntries.clear();
+    }
 
-            for (const auto &[date, entries] : dailyLogs)
+    // Serializes a copy of the logs on the persistence worker. Days still in
+    // the mirror are copied from it; the new mirror is written alongside. When
+    // the archive is due, it is rewritten first and the days it took are left
+    // out of the log file, so a crash in between only duplicates them.
+    future<PersistResult> saveLogsAsync()
+    {
+        auto builder = make_shared<RecordFile::Builder>(recordSizes());
+        bool rewriteArchive = archiveDue();
+        auto serialize = [logs = dailyLogs, records = logRecords, faulted = faultedDates, indent = jsonIndent, builder,
+                          rewriteArchive, archived = archive, faultedArchived = faultedArchiveDates,
+                          cutoff = archiveCutoff(), path = archivePath()]()
+        {
+            set<string, less<>> moved;
+            if (rewriteArchive)
             {
-                json dateEntries = json::array();
-
-                for (const auto &entry : entries)
+                // Old days leaving the log file, and archived days edited this session
+                map<int32_t, vector<FoodEntry>> days;
+                forEachSavedDay(logs, records.get(), faulted, [&](string_view date, size_t count, auto forEntries)
+                                {
+                    int32_t dayNumber;
+                    if ((date < cutoff || faultedArchived.count(date)) && DateUtil::toDayNumber(string(date), dayNumber))
+                    {
+                        vector<FoodEntry> &entries = days[dayNumber];
+                        entries.reserve(count);
+                        forEntries([&](string_view food, double servings, double calories)
+                                   { entries.emplace_back(string(food), servings, calories); });
+                        moved.emplace(date);
+                    } });
+                // Everything archived before, except days edited (or emptied) since
+                for (size_t block = 0; archived && block < archived->blockCount(); ++block)
                 {
-                    json entryJson;
-                    entryJson["food"] = entry.foodName;
-                    entryJson["servings"] = entry.servings;
-                    entryJson["calories"] = entry.calories;
-                    dateEntries.push_back(entryJson);
+                    for (const auto &day : archived->decodeBlock(block))
+                    {
+                        if (days.count(day.day) || faultedArchived.count(DateUtil::fromDayNumber(day.day)))
+                            continue;
+                        vector<FoodEntry> &entries = days[day.day];
+                        for (const auto &entry : day.entries)
+                            entries.emplace_back(string(archived->foodName(entry.food)), entry.servings, entry.calories);
+                    }
                 }
+                PersistResult written = PersistenceWorker::writeAtomically(path, DiaryArchive::encode(days));
+                if (!written.ok)
+                    throw runtime_error(written.error);
+            }
+
+            JsonStreamWriter writer(indent);
+            writer.beginObject();
+            forEachSavedDay(logs, records.get(), faulted, [&](string_view date, size_t count, auto forEntries)
+                            {
+                if (moved.count(date))
+                    return;
+                writer.key(date).beginArray();
+                builder->add(DAYS, DayRecord{builder->intern(date), static_cast<uint32_t>(builder->count(ENTRIES)),
+                                             static_cast<uint32_t>(count)});
+                forEntries([&](string_view food, double servings, double calories)
+                           {
+                    FoodEntry::writeJson(writer, food, servings, calories);
+                    builder->add(ENTRIES, FoodEntry::Record{builder->intern(food), servings, calories}); });
+                writer.endArray(); });
+            writer.endObject();
+            return writer.take();
+        };
+
+        // The mirror is stamped with the log file it was built with
+        auto afterCommit = [path = logFile, mirror = recordsPath(), builder]()
+        {
+            FileStamp source;
+            if (FileStamp::of(path, source))
+                builder->write(mirror, RecordFile::DIARY, source);
+        };
+        return PersistenceWorker::instance().submit(logFile, serialize, afterCommit);
+    }
+
+    void setCompactJson(bool compact)
+    {
+        jsonIndent = compact ? -1 : 4;
+    }
+
+    bool needsSave() const
+    {
+        return !dirtyDates.empty() || mirrorStale || archiveDue() || convertToMonths;
+    }
+
+    // Stores the logs by month from the next save on
+    void setMonthlyPartitions(bool monthly)
+    {
+        monthsRequested = monthly;
+    }
+
+    // Moves days older than `days` into the archive on save; 0 turns this off
+    void setArchiveAfterDays(int days)
+    {
+        archiveAfterDays = days;
+    }
+
+    // Queues the saves needed, if anything changed
+    vector<future<PersistResult>> startSave()
+    {
+        vector<future<PersistResult>> saves;
+        if (partitioned || convertToMonths)
+            saves = saveMonthsAsync();
+        else if (needsSave())
+            saves.push_back(saveLogsAsync());
+        return saves;
+    }
 
-                j[date] = dateEntries;
+    // Reports saves from startSave; the diary must not change in between
+    void finishSave(vector<future<PersistResult>> pending)
+    {
+        if (pending.empty() && !convertToMonths)
+            return;
+
+        bool saved = true;
+        for (auto &save : pending)
+        {
+            PersistResult result = save.get();
+            if (!result.ok)
+            {
+                cerr << "Error saving logs: " << result.error << endl;
+                saved = false;
             }
+        }
+        if (!saved)
+            return;
 
-            ofstream file(logFile);
-            if (!file.is_open())
+        if (convertToMonths)
+        {
+            ::mkdir(monthsDirectory().c_str(), 0755);
+            json manifest = {{"version", MONTHS_VERSION}};
+            PersistResult result = PersistenceWorker::writeAtomically(monthsManifestPath(), manifest.dump(2), false);
+            if (!result.ok)
             {
-                cerr << "Unable to open log file for writing: " << logFile << endl;
+                cerr << "Error saving logs: " << result.error << endl;
                 return;
             }
-
-            file << setw(4) << j;
-            file.close();
-
-            cout << "Logs saved successfully." << endl;
+            // The months hold every day now; backups of the old files are kept
+            for (const string &path : {logFile, recordsPath(), archivePath()})
+            {
+                ::remove(path.c_str());
+                ::remove(DataIntegrity::sidecarPath(path).c_str());
+            }
+            convertToMonths = false;
+            partitioned = true;
+            cout << "Food logs converted to monthly files in " << monthsDirectory() << "." << endl;
         }
-        catch (const exception &e)
+        dirtyDates.clear();
+        mirrorStale = false;
+        if (archiveDue())
         {
-            cerr << "Error saving logs: " << e.what() << endl;
+            faultedArchiveDates.clear();
+            archiveSavedAt = archiveCutoff();
         }
+
+        cout << "Logs saved successfully." << endl;
+    }
+
+    void saveLogs()
+    {
+        finishSave(startSave());
     }
 
     // Command to add a food entry
@@ -615,12 +6970,12 @@ public:
 
         void execute() override
         {
-            diary.dailyLogs[date].emplace_back(foodName, servings, calories);
+            diary.logFor(date).emplace_back(foodName, servings, calories);
         }
 
         void undo() override
         {
-            auto &entries = diary.dailyLogs[date];
+            auto &entries = diary.logFor(date);
             if (!entries.empty())
             {
                 // Remove the latest entry with this food name
@@ -665,7 +7020,7 @@ public:
               deletedEntry("", 0, 0)
         {
             // Store the entry for potential undo
-            auto &entries = diary.dailyLogs[date];
+            auto &entries = diary.logFor(date);
             if (index < entries.size())
             {
                 deletedEntry = entries[index];
@@ -674,7 +7029,7 @@ public:
 
         void execute() override
         {
-            auto &entries = diary.dailyLogs[date];
+            auto &entries = diary.logFor(date);
             if (index < entries.size())
             {
                 entries.erase(entries.begin() + index);
@@ -689,7 +7044,7 @@ public:
         void undo() override
         {
             // Re-add the deleted entry
-            diary.dailyLogs[date].push_back(deletedEntry);
+            diary.logFor(date).push_back(deletedEntry);
         }
 
         string getDescription() const override
@@ -707,6 +7062,7 @@ public:
         if (DateUtil::isValidDate(date))
         {
             currentDate = date;
+            prefetchAround(currentDate);
             cout << "Current date set to: " << currentDate << endl;
         }
         else
@@ -720,11 +7076,36 @@ public:
         return currentDate;
     }
 
+    // Nutrient totals of a day in one kernel pass over the logged foods.
+    // Calories are the logged ones, so the total matches the log.
+    NutrientVector dailyNutrients(const string &date) const
+    {
+        vector<NutrientVector> foods;
+        vector<float> servings;
+        double calories = 0.0;
+        forEachEntry(date, [&](string_view foodName, double entryServings, double entryCalories)
+                     {
+            calories += entryCalories;
+            if (auto food = dbManager.getFood(string(foodName)))
+            {
+                foods.push_back(food->getNutrients());
+                servings.push_back(static_cast<float>(entryServings));
+            } });
+
+        vector<const NutrientVector *> rows;
+        rows.reserve(foods.size());
+        for (const auto &food : foods)
+            rows.push_back(&food);
+        NutrientVector total;
+        NutrientKernels::accumulate(total, rows.data(), servings.data(), rows.size());
+        total[NutrientVector::CALORIES] = static_cast<float>(calories);
+        return total;
+    }
+
     // Log display
     void displayDailyLog(const string &date) const
     {
-        auto it = dailyLogs.find(date);
-        if (it == dailyLogs.end() || it->second.empty())
+        if (entryCount(date) == 0)
         {
             cout << "No food entries for " << date << endl;
             return;
@@ -740,19 +7121,28 @@ public:
         cout << string(65, '-') << endl;
 
         int count = 1;
-        for (const auto &entry : it->second)
-        {
+        forEachEntry(date, [&](string_view foodName, double servings, double calories)
+                     {
             cout << setw(5) << left << count++
-                 << setw(30) << left << entry.foodName
-                 << setw(15) << left << entry.servings
-                 << setw(15) << right << entry.calories << endl;
+                 << setw(30) << left << foodName
+                 << setw(15) << left << servings
+                 << setw(15) << right << calories << endl;
 
-            totalCalories += entry.calories;
-        }
+            totalCalories += calories; });
 
         cout << string(65, '-') << endl;
         cout << setw(50) << left << "Total Calories:"
              << setw(15) << right << totalCalories << endl;
+
+        NutrientVector nutrients = dailyNutrients(date);
+        for (size_t i = NutrientVector::CALORIES + 1; i < NutrientVector::COUNT; ++i)
+        {
+            if (nutrients[i] == 0.0f)
+                continue;
+            cout << setw(50) << left
+                 << "Total " + string(NutrientVector::label(i)) + " (" + string(NutrientVector::unit(i)) + "):"
+                 << setw(15) << right << nutrients[i] << endl;
+        }
         cout << endl;
     }
 
@@ -795,6 +7185,7 @@ public:
 
     void deleteFood(const string &date, size_t index)
     {
+        materializeDate(date);
         auto it = dailyLogs.find(date);
         if (it == dailyLogs.end() || index >= it->second.size())
         {
@@ -826,11 +7217,8 @@ public:
             // List all foods for selection
             dbManager.listAllFoods();
 
-            // Convert map to vector for indexing
-            for (const auto &[name, food] : dbManager.foods)
-            {
-                foodOptions.push_back(name);
-            }
+            // Same order as the listing above
+            foodOptions = dbManager.listFoodNames();
         }
         else if (choice == 2)
         {
@@ -923,6 +7311,7 @@ public:
     {
         displayDailyLog(currentDate);
 
+        materializeDate(currentDate);
         auto it = dailyLogs.find(currentDate);
         if (it == dailyLogs.end() || it->second.empty())
         {
@@ -978,17 +7367,9 @@ public:
     }
     double getTotalCaloriesForDate(const string &date) const
     {
-        auto it = dailyLogs.find(date);
-        if (it == dailyLogs.end())
-        {
-            return 0.0;
-        }
-
         double totalCalories = 0.0;
-        for (const auto &entry : it->second)
-        {
-            totalCalories += entry.calories;
-        }
+        forEachEntry(date, [&](string_view, double, double calories)
+                     { totalCalories += calories; });
         return totalCalories;
     }
 };
@@ -1004,6 +7385,34 @@ public:
     DailyProfile(double w = 70.0, ActivityLevel a = ActivityLevel::MODERATELY_ACTIVE)
         : weight(w), activityLevel(a) {}
 
+    // Binary form in a profile mirror (schema version 1), sorted by date
+    struct Record
+    {
+        RecordFile::StringRef date;
+        uint32_t activityLevel;
+        uint32_t reserved;
+        double weight;
+    };
+
+    // Read-only daily profile in a mapped profile mirror
+    class View
+    {
+    private:
+        const RecordFile *file;
+        const char *record;
+
+    public:
+        View(const RecordFile &f, const char *r) : file(&f), record(r) {}
+
+        string_view date() const { return file->text(RecordFile::read<RecordFile::StringRef>(record + offsetof(Record, date))); }
+        double getWeight() const { return RecordFile::read<double>(record + offsetof(Record, weight)); }
+        ActivityLevel getActivityLevel() const
+        {
+            return static_cast<ActivityLevel>(RecordFile::read<uint32_t>(record + offsetof(Record, activityLevel)));
+        }
+        DailyProfile get() const { return DailyProfile(getWeight(), getActivityLevel()); }
+    };
+
     double getWeight() const { return weight; }
     void setWeight(double w) { weight = w; }
 
@@ -1037,6 +7446,63 @@ private:
     CalorieCalculationMethod calculationMethod;
     unordered_map<string, DailyProfile> dailyProfiles;
 
+    // Binary mirror of the profile file (user_profile.json.bin). Daily profiles
+    // not in dailyProfiles are read from it in place; dailyProfiles wins.
+    struct Record
+    {
+        RecordFile::StringRef userId;
+        uint32_t gender;
+        int32_t age;
+        double height;
+        uint32_t calculationMethod;
+        uint32_t reserved;
+    };
+    enum RecordSection : size_t
+    {
+        PROFILE,
+        DAILY_PROFILES
+    };
+    shared_ptr<const RecordFile> records;
+
+    // Daily profiles and personal details changed since the last save
+    set<string> dirtyDates;
+    bool detailsDirty = false;
+
+    DailyProfile::View recordAt(size_t index) const
+    {
+        return DailyProfile::View(*records, records->record(DAILY_PROFILES, index));
+    }
+
+    // First mirrored daily profile dated on or after `date`
+    size_t lowerBound(string_view date) const
+    {
+        size_t low = 0, high = records ? records->count(DAILY_PROFILES) : 0;
+        while (low < high)
+        {
+            size_t middle = low + (high - low) / 2;
+            if (recordAt(middle).date() < date)
+                low = middle + 1;
+            else
+                high = middle;
+        }
+        return low;
+    }
+
+    bool findDailyProfile(const string &date, DailyProfile &profile) const
+    {
+        auto it = dailyProfiles.find(date);
+        if (it != dailyProfiles.end())
+        {
+            profile = it->second;
+            return true;
+        }
+        size_t index = lowerBound(date);
+        if (!records || index == records->count(DAILY_PROFILES) || recordAt(index).date() != date)
+            return false;
+        profile = recordAt(index).get();
+        return true;
+    }
+
     // Calculate BMR using Harris-Benedict equation
     double calculateBMRHarrisBenedict(double weight) const
     {
@@ -1095,27 +7561,51 @@ public:
     string getUserId() const { return userId; }
 
     Gender getGender() const { return gender; }
-    void setGender(Gender g) { gender = g; }
+    void setGender(Gender g)
+    {
+        gender = g;
+        detailsDirty = true;
+    }
 
     double getHeight() const { return height; }
-    void setHeight(double h) { height = h; }
+    void setHeight(double h)
+    {
+        height = h;
+        detailsDirty = true;
+    }
 
     int getAge() const { return age; }
-    void setAge(int a) { age = a; }
+    void setAge(int a)
+    {
+        age = a;
+        detailsDirty = true;
+    }
 
     CalorieCalculationMethod getCalculationMethod() const { return calculationMethod; }
-    void setCalculationMethod(CalorieCalculationMethod m) { calculationMethod = m; }
+    void setCalculationMethod(CalorieCalculationMethod m)
+    {
+        calculationMethod = m;
+        detailsDirty = true;
+    }
+
+    bool isDirty() const { return detailsDirty || !dirtyDates.empty(); }
+    void markClean()
+    {
+        detailsDirty = false;
+        dirtyDates.clear();
+    }
 
     // Calculate daily calorie target
     double calculateDailyCalorieTarget(const string &date)
     {
-        if (dailyProfiles.find(date) == dailyProfiles.end())
+        DailyProfile profile;
+        if (!findDailyProfile(date, profile))
         {
             // If no profile exists for this date, copy from most recent day or use default
             setDailyProfileFromMostRecent(date);
+            profile = dailyProfiles[date];
         }
 
-        const DailyProfile &profile = dailyProfiles[date];
         double bmr = 0.0;
 
         // Calculate BMR based on selected method
@@ -1135,30 +7625,42 @@ public:
     // Check if a profile exists for a specific date
     bool hasProfileForDate(const string &date) const
     {
-        return dailyProfiles.find(date) != dailyProfiles.end();
+        DailyProfile profile;
+        return findDailyProfile(date, profile);
     }
 
     // Set daily profile for a specific date
     void setDailyProfile(const string &date, const DailyProfile &profile)
     {
         dailyProfiles[date] = profile;
+        dirtyDates.insert(date);
     }
 
     // Get daily profile for a specific date
     DailyProfile getDailyProfile(const string &date)
     {
-        if (dailyProfiles.find(date) == dailyProfiles.end())
+        DailyProfile profile;
+        if (!findDailyProfile(date, profile))
         {
             setDailyProfileFromMostRecent(date);
+            profile = dailyProfiles[date];
         }
-        return dailyProfiles[date];
+        return profile;
     }
 
     // Set profile for a date based on most recent available profile
     void setDailyProfileFromMostRecent(const string &targetDate)
     {
+        // The copied profile is recorded for targetDate, so it is saved
+        dirtyDates.insert(targetDate);
+
+        // Mirrored daily profiles dated up to targetDate end at `upper`
+        size_t upper = lowerBound(targetDate);
+        if (records && upper < records->count(DAILY_PROFILES) && recordAt(upper).date() == targetDate)
+            ++upper;
+
         // If no profiles exist yet, create a default one
-        if (dailyProfiles.empty())
+        if (dailyProfiles.empty() && !(records && records->count(DAILY_PROFILES)))
         {
             dailyProfiles[targetDate] = DailyProfile();
             return;
@@ -1174,6 +7676,13 @@ public:
             }
         }
 
+        // An edited daily profile shadows its mirrored one, so only a later one wins
+        if (upper > 0 && recordAt(upper - 1).date() > mostRecentDate)
+        {
+            dailyProfiles[targetDate] = recordAt(upper - 1).get();
+            return;
+        }
+
         // If found, copy that profile; otherwise use the earliest available profile
         if (!mostRecentDate.empty())
         {
@@ -1212,11 +7721,141 @@ public:
         {
             dailyProfilesJson[date] = profile.toJson();
         }
+        for (size_t i = 0; records && i < records->count(DAILY_PROFILES); ++i)
+        {
+            string date(recordAt(i).date());
+            if (!dailyProfiles.count(date))
+                dailyProfilesJson[date] = recordAt(i).get().toJson();
+        }
         j["dailyProfiles"] = dailyProfilesJson;
 
         return j;
     }
 
+    // Binary mirror of toJson(), daily profiles sorted by date
+    void toRecords(RecordFile::Builder &builder) const
+    {
+        builder.add(PROFILE, Record{builder.intern(userId), static_cast<uint32_t>(gender), age, height,
+                                     static_cast<uint32_t>(calculationMethod), 0});
+
+        map<string_view, DailyProfile> merged;
+        for (const auto &[date, profile] : dailyProfiles)
+            merged.emplace(date, profile);
+        for (size_t i = 0; records && i < records->count(DAILY_PROFILES); ++i)
+            merged.emplace(recordAt(i).date(), recordAt(i).get());
+        for (const auto &[date, profile] : merged)
+        {
+            builder.add(DAILY_PROFILES, DailyProfile::Record{builder.intern(date), static_cast<uint32_t>(profile.getActivityLevel()), 0,
+                                                             profile.getWeight()});
+        }
+    }
+
+    static vector<uint32_t> recordSizes()
+    {
+        return {sizeof(Record), sizeof(DailyProfile::Record)};
+    }
+
+    // Profile served from a mapped mirror; false if it is malformed
+    static bool fromRecords(shared_ptr<const RecordFile> mirror, UserProfile &profile)
+    {
+        if (mirror->count(PROFILE) != 1)
+            return false;
+        for (size_t i = 1; i < mirror->count(DAILY_PROFILES); ++i)
+        {
+            if (!(DailyProfile::View(*mirror, mirror->record(DAILY_PROFILES, i - 1)).date() <
+                  DailyProfile::View(*mirror, mirror->record(DAILY_PROFILES, i)).date()))
+                return false;
+        }
+
+        const char *record = mirror->record(PROFILE, 0);
+        profile = UserProfile(
+            string(mirror->text(RecordFile::read<RecordFile::StringRef>(record + offsetof(Record, userId)))),
+            static_cast<Gender>(RecordFile::read<uint32_t>(record + offsetof(Record, gender))),
+            RecordFile::read<double>(record + offsetof(Record, height)),
+            RecordFile::read<int32_t>(record + offsetof(Record, age)),
+            static_cast<CalorieCalculationMethod>(RecordFile::read<uint32_t>(record + offsetof(Record, calculationMethod))));
+        profile.records = move(mirror);
+        return true;
+    }
+
+    // Fast path for a profile file in the shape toJson writes; false if it
+    // must be read through nlohmann instead
+    static bool fromFastJson(const char *data, size_t size, UserProfile &result)
+    {
+        try
+        {
+            FastJsonReader reader(data, data + size);
+            UserProfile profile;
+            unsigned seen = 0;
+            auto once = [&](unsigned bit)
+            {
+                if (seen & bit)
+                    throw FastJsonReader::Miss();
+                seen |= bit;
+            };
+            reader.readObject([&](const string &key)
+                              {
+                if (key == "userId")
+                {
+                    once(1);
+                    profile.userId = reader.readString();
+                }
+                else if (key == "gender")
+                {
+                    once(2);
+                    profile.gender = static_cast<Gender>(reader.readInt());
+                }
+                else if (key == "height")
+                {
+                    once(4);
+                    profile.height = reader.readNumber();
+                }
+                else if (key == "age")
+                {
+                    once(8);
+                    profile.age = reader.readInt();
+                }
+                else if (key == "calculationMethod")
+                {
+                    once(16);
+                    profile.calculationMethod = static_cast<CalorieCalculationMethod>(reader.readInt());
+                }
+                else if (key == "dailyProfiles")
+                {
+                    once(32);
+                    reader.readObject([&](const string &date)
+                                      {
+                        double weight = 0.0;
+                        int activityLevel = 0;
+                        unsigned fields = 0;
+                        reader.readObject([&](const string &field)
+                                          {
+                            unsigned bit = field == "weight" ? 1 : field == "activityLevel" ? 2 : 0;
+                            if (bit == 0 || (fields & bit))
+                                throw FastJsonReader::Miss();
+                            fields |= bit;
+                            if (bit == 1)
+                                weight = reader.readNumber();
+                            else
+                                activityLevel = reader.readInt(); });
+                        if (fields != 3 || !profile.dailyProfiles.emplace(date, DailyProfile(weight, static_cast<ActivityLevel>(activityLevel))).second)
+                            throw FastJsonReader::Miss(); });
+                }
+                else
+                {
+                    throw FastJsonReader::Miss();
+                } });
+            if ((seen & 31) != 31 || !reader.atEnd())
+                return false;
+            result = move(profile);
+            return true;
+        }
+        catch (const FastJsonReader::Miss &)
+        {
+            return false;
+        }
+    }
+
     // Load profile from JSON
     static UserProfile fromJson(const json &j)
     {
@@ -1246,6 +7885,8 @@ private:
     UserProfile userProfile;
     FoodDiary& foodDiary;
     string profileFilePath;
+    bool loadAttempted = false; // never save over a file that was not read
+    bool mirrorStale = false;   // the profile file was parsed, so its mirror must be rebuilt
 
     string getActivityLevelString(ActivityLevel level) const
     {
@@ -1295,56 +7936,109 @@ private:
     }
 
 public:
-    ProfileManager(FoodDiary &fd, const string &profileFile)
+    // With deferLoad the owner calls loadProfile itself
+    ProfileManager(FoodDiary &fd, const string &profileFile, bool deferLoad = false)
         : foodDiary(fd), profileFilePath(profileFile)
     {
-        loadProfile();
+        if (!deferLoad)
+        {
+            loadProfile();
+        }
     }
 
     ~ProfileManager()
     {
-        saveProfile();
+        if (loadAttempted)
+        {
+            saveProfile();
+        }
     }
 
-    // Load profile from file
-    void loadProfile()
+    // Load profile from file; safe to run on a loader thread
+    void loadProfile(ostream &out = cout)
     {
+        loadAttempted = true;
         try
         {
+            DataIntegrity::recover(profileFilePath, out);
+            FileStamp source;
+            auto mirror = make_shared<RecordFile>();
+            if (FileStamp::of(profileFilePath, source) &&
+                mirror->open(profileFilePath + ".bin", RecordFile::PROFILE, source, UserProfile::recordSizes()) &&
+                UserProfile::fromRecords(mirror, userProfile))
+            {
+                out << "Profile loaded successfully." << endl;
+                return;
+            }
+
             ifstream file(profileFilePath);
             if (!file.is_open())
             {
-                cout << "No existing profile found. Starting with default profile." << endl;
+                out << "No existing profile found. Starting with default profile." << endl;
                 return;
             }
 
-            json j;
-            file >> j;
-            userProfile = UserProfile::fromJson(j);
+            MappedFile mapped;
+            if (!mapped.map(profileFilePath) || !UserProfile::fromFastJson(mapped.begin(), mapped.size(), userProfile))
+            {
+                json j;
+                file >> j;
+                userProfile = UserProfile::fromJson(j);
+            }
+            mirrorStale = true;
 
-            cout << "Profile loaded successfully." << endl;
+            out << "Profile loaded successfully." << endl;
         }
         catch (const exception &e)
         {
-            cout << "Error loading profile: " << e.what() << endl;
+            out << "Error loading profile: " << e.what() << endl;
         }
     }
 
-    // Save profile to file
-    void saveProfile()
+    // Save profile to file on the persistence worker
+    future<PersistResult> saveProfileAsync()
     {
-        try
+        // The mirror is stamped with the profile file it was built with
+        auto builder = make_shared<RecordFile::Builder>(UserProfile::recordSizes());
+        auto afterCommit = [path = profileFilePath, builder]()
         {
-            json j = userProfile.toJson();
+            FileStamp source;
+            if (FileStamp::of(path, source))
+                builder->write(path + ".bin", RecordFile::PROFILE, source);
+        };
+        return PersistenceWorker::instance().submit(profileFilePath, [profile = userProfile, builder]()
+                                                    {
+            profile.toRecords(*builder);
+            return profile.toJson().dump(2); }, afterCommit);
+    }
 
-            ofstream file(profileFilePath);
-            file << j.dump(2);
-            cout << "Profile saved successfully." << endl;
-        }
-        catch (const exception &e)
+    // Only a changed profile is rewritten; the future is empty otherwise
+    future<PersistResult> startSave()
+    {
+        return userProfile.isDirty() || mirrorStale ? saveProfileAsync() : future<PersistResult>();
+    }
+
+    // Reports a save from startSave; the profile must not change in between
+    void finishSave(future<PersistResult> pending)
+    {
+        if (!pending.valid())
+            return;
+
+        PersistResult result = pending.get();
+        if (!result.ok)
         {
-            cout << "Error saving profile: " << e.what() << endl;
+            cout << "Error saving profile: " << result.error << endl;
+            return;
         }
+        userProfile.markClean();
+        mirrorStale = false;
+
+        cout << "Profile saved successfully." << endl;
+    }
+
+    void saveProfile()
+    {
+        finishSave(startSave());
     }
 
     // Display user profile
@@ -1508,6 +8202,29 @@ private:
     FoodDiary foodDiary;
     ProfileManager profileManager;
     bool running;
+    vector<shared_future<PersistResult>> pendingSaves;
+    vector<future<PersistResult>> logSave;
+    future<PersistResult> profileSave;
+
+    // Reports background saves that have finished, or waits for all of them
+    void reportFinishedSaves(bool wait = false)
+    {
+        for (auto it = pendingSaves.begin(); it != pendingSaves.end();)
+        {
+            if (!wait && it->wait_for(chrono::seconds(0)) != future_status::ready)
+            {
+                ++it;
+                continue;
+            }
+
+            const PersistResult &result = it->get();
+            if (result.ok)
+                cout << "Database saved to " << result.path << endl;
+            else
+                cout << "Error saving database: " << result.error << endl;
+            it = pendingSaves.erase(it);
+        }
+    }
 
     void displayMenu()
     {
@@ -1527,9 +8244,11 @@ private:
         cout << "13. Update User Profile\n";
         cout << "14. Change calorie calculation method\n";
         cout << "15. View Calorie summary\n";
-        cout << "16. Exit\n";
+        cout << "16. Import foods from CSV/TSV\n";
+        cout << "17. Update food calories\n";
+        cout << "18. Exit\n";
         cout << "==============================\n";
-        cout << "Enter choice (1-17): ";
+        cout << "Enter choice (1-18): ";
     }
 
     void searchFoods()
@@ -1610,6 +8329,29 @@ private:
         }
     }
 
+    void updateFoodCalories()
+    {
+        cout << "\nEnter food name: ";
+        string name;
+        cin.ignore(numeric_limits<streamsize>::max(), '\n');
+        getline(cin, name);
+
+        cout << "Enter new calories per serving: ";
+        float calories;
+        cin >> calories;
+        if (!cin || calories < 0)
+        {
+            cin.clear();
+            cout << "Invalid calories." << endl;
+            return;
+        }
+
+        if (dbManager.updateFoodCalories(name, calories))
+        {
+            cout << "Calories of '" << name << "' updated." << endl;
+        }
+    }
+
     void addBasicFood()
     {
         string name;
@@ -1650,7 +8392,36 @@ private:
         if (!keywordsStr.empty())
             keywords.push_back(keywordsStr);
 
-        auto newFood = make_shared<BasicFood>(name, keywords, calories);
+        cout << "Other nutrients per serving, e.g. protein=31, fat=3.6 (blank for none): ";
+        string nutrientsStr;
+        getline(cin, nutrientsStr);
+        NutrientVector nutrients;
+        stringstream nutrientStream(nutrientsStr);
+        while (getline(nutrientStream, token, ','))
+        {
+            if (token.find_first_not_of(' ') == string::npos)
+                continue;
+            size_t equals = token.find('=');
+            string nutrientName = token.substr(0, equals);
+            nutrientName.erase(0, nutrientName.find_first_not_of(' '));
+            nutrientName.erase(nutrientName.find_last_not_of(' ') + 1);
+            size_t index = NutrientVector::findDetail(nutrientName);
+            if (equals == string::npos || index == NutrientVector::npos)
+            {
+                cout << "Ignoring unknown nutrient '" << token << "'." << endl;
+                continue;
+            }
+            try
+            {
+                nutrients[index] = stof(token.substr(equals + 1));
+            }
+            catch (const exception &)
+            {
+                cout << "Ignoring invalid amount in '" << token << "'." << endl;
+            }
+        }
+
+        auto newFood = make_shared<BasicFood>(name, keywords, calories, nutrients);
         if (dbManager.addFood(newFood))
         {
             cout << "Basic food '" << name << "' added successfully." << endl;
@@ -1736,38 +8507,178 @@ private:
         }
     }
 
+    void importFoods()
+    {
+        cin.ignore(numeric_limits<streamsize>::max(), '\n');
+
+        cout << "\n=== Import Foods from CSV/TSV ===" << endl;
+        cout << "Enter file path: ";
+        string path;
+        getline(cin, path);
+
+        NutrientTableImporter importer;
+        if (!importer.open(path))
+        {
+            cout << "Unable to open '" << path << "'." << endl;
+            return;
+        }
+
+        cout << "Columns: ";
+        for (size_t i = 0; i < importer.columns().size(); ++i)
+        {
+            cout << importer.columns()[i];
+            if (i < importer.columns().size() - 1)
+                cout << ", ";
+        }
+        cout << endl;
+
+        NutrientTableImporter::ColumnMapping mapping;
+        string column;
+        cout << "Column with the food name: ";
+        getline(cin, column);
+        mapping.name = importer.findColumn(column);
+        cout << "Column with calories per serving: ";
+        getline(cin, column);
+        mapping.calories = importer.findColumn(column);
+        if (mapping.name == string_view::npos || mapping.calories == string_view::npos)
+        {
+            cout << "Unknown column. Import cancelled." << endl;
+            return;
+        }
+
+        cout << "Keyword columns (comma-separated, blank for none): ";
+        string keywordColumns;
+        getline(cin, keywordColumns);
+        stringstream ss(keywordColumns);
+        while (getline(ss, column, ','))
+        {
+            size_t index = importer.findColumn(column);
+            if (index != string_view::npos)
+                mapping.keywords.push_back(index);
+            else if (column.find_first_not_of(' ') != string::npos)
+                cout << "Ignoring unknown column '" << column << "'." << endl;
+        }
+
+        // Columns named after a nutrient are imported with it
+        string nutrientNames;
+        for (size_t i = 0; i < importer.columns().size(); ++i)
+        {
+            size_t index = NutrientVector::findDetail(importer.columns()[i]);
+            if (index == NutrientVector::npos || i == mapping.name)
+                continue;
+            mapping.nutrients.emplace_back(i, index);
+            nutrientNames += (nutrientNames.empty() ? "" : ", ") + string(NutrientVector::label(index));
+        }
+        if (!nutrientNames.empty())
+            cout << "Nutrient columns: " << nutrientNames << endl;
+
+        auto result = importer.parse(mapping);
+        size_t duplicates = 0;
+        size_t added = dbManager.addFoodsBatch(move(result.foods), &duplicates);
+        cout << "Imported " << added << " foods (" << duplicates << " duplicates, "
+             << result.invalidRows << " invalid rows skipped)." << endl;
+    }
+
+    // Queues every store that needs saving as one batch; start() reports them
     void handleExit()
     {
+        PersistenceWorker::Batch batch;
         if (dbManager.isModified())
         {
-            cout << "Database has unsaved changes. Save before exit? (y/n): ";
+            cout << "Database changes are only recorded in its journal. Save full database before exit? (y/n): ";
             char choice;
             cin >> choice;
 
             if (choice == 'y' || choice == 'Y')
             {
-                dbManager.saveDatabase();
+                pendingSaves.push_back(dbManager.saveDatabaseAsync());
             }
         }
+        logSave = foodDiary.startSave();
+        profileSave = profileManager.startSave();
 
         running = false;
     }
 
 public:
     DietAssistantCLI(const string &databasePath = "food_database.json", const string &logPath = "food_log.json", const string &profilePath = "user_profile.json")
-        : dbManager(databasePath), foodDiary(dbManager, logPath), profileManager(foodDiary, profilePath), running(false)
+        : dbManager(databasePath, true), foodDiary(dbManager, logPath, true), profileManager(foodDiary, profilePath, true), running(false)
     {
     }
 
+    // Loads the diary and profile on their own threads while the catalog loads
+    // here, then prints their buffered messages in the usual order
+    void loadStores()
+    {
+        ostringstream diaryOut, diaryErr, profileOut;
+        future<void> diaryLoad = async(launch::async, [&]
+                                       { foodDiary.loadLogs(diaryOut, diaryErr); });
+        future<void> profileLoad = async(launch::async, [&]
+                                         { profileManager.loadProfile(profileOut); });
+
+        ostringstream databaseOut;
+        streambuf *console = cout.rdbuf(databaseOut.rdbuf());
+        try
+        {
+            dbManager.loadDatabase();
+        }
+        catch (...)
+        {
+            cout.rdbuf(console);
+            diaryLoad.wait();
+            profileLoad.wait();
+            throw;
+        }
+        cout.rdbuf(console);
+        diaryLoad.get();
+        profileLoad.get();
+
+        cout << diaryOut.str();
+        cerr << diaryErr.str();
+        cout << profileOut.str() << databaseOut.str();
+        foodDiary.resolvePendingCalories();
+    }
+
+    // Attach to the catalog image shared by all processes on this host
+    void useSharedCatalog()
+    {
+        dbManager.setSharedCatalog(true);
+    }
+
+    // Keep the catalog in shard files loaded on demand
+    void useShardedCatalog(uint32_t shards)
+    {
+        dbManager.setShardCount(shards);
+    }
+
+    // Write the catalog and diary without indentation, which is smaller and faster to parse
+    void writeCompactJson()
+    {
+        dbManager.setCompactJson(true);
+        foodDiary.setCompactJson(true);
+    }
+
+    void archiveDiaryAfter(int days)
+    {
+        foodDiary.setArchiveAfterDays(days);
+    }
+
+    // Keep the diary in one file per month, loaded on demand
+    void partitionDiaryByMonth()
+    {
+        foodDiary.setMonthlyPartitions(true);
+    }
+
     void start()
     {
         running = true;
-        dbManager.loadDatabase();
+        loadStores();
 
         cout << "Welcome to Diet Assistant!" << endl;
 
         while (running)
         {
+            reportFinishedSaves();
             displayMenu();
 
             int choice;
@@ -1791,7 +8702,8 @@ public:
                 dbManager.listAllFoods();
                 break;
             case 6:
-                dbManager.saveDatabase();
+                pendingSaves.push_back(dbManager.saveDatabaseAsync());
+                cout << "Saving database in the background..." << endl;
                 break;
             case 7:
                 foodDiary.displayDailyLog(foodDiary.getCurrentDate());
@@ -1821,6 +8733,12 @@ public:
                 profileManager.displayCalorieSummary(foodDiary.getCurrentDate());
                 break;
             case 16:
+                importFoods();
+                break;
+            case 17:
+                updateFoodCalories();
+                break;
+            case 18:
                 handleExit();
                 break;
             default:
@@ -1828,13 +8746,681 @@ public:
             }
         }
 
+        // Every save of the batch is reported before the farewell
+        reportFinishedSaves(true);
+        profileManager.finishSave(move(profileSave));
+        foodDiary.finishSave(move(logSave));
         cout << "Thank you for using Diet Assistant. Goodbye!" << endl;
     }
 };
 
-int main()
+// Checks the data files and their backups against their checksums; returns
+// the process exit code
+int verifyDataFiles()
+{
+    bool corrupt = false;
+    uint64_t bytes = 0;
+    auto start = chrono::steady_clock::now();
+    vector<string> files = {"food_database.json", "food_log.json", "food_log.json.archive", "user_profile.json"};
+    if (DIR *months = ::opendir("food_log.json.months"))
+    {
+        vector<string> monthFiles;
+        while (dirent *entry = ::readdir(months))
+        {
+            string name = entry->d_name;
+            if (name.size() > 5 && name.compare(name.size() - 5, 5, ".json") == 0)
+                monthFiles.push_back("food_log.json.months/" + name);
+        }
+        ::closedir(months);
+        sort(monthFiles.begin(), monthFiles.end());
+        files.insert(files.end(), monthFiles.begin(), monthFiles.end());
+    }
+    for (const string &file : files)
+    {
+        for (const string &path : {file, DataIntegrity::backupPath(file)})
+        {
+            DataIntegrity::Status status = DataIntegrity::verify(path);
+            if (status == DataIntegrity::Status::MISSING)
+                continue;
+
+            FileStamp stamp;
+            FileStamp::of(path, stamp);
+            if (status == DataIntegrity::Status::VERIFIED)
+                bytes += stamp.size;
+            corrupt = corrupt || status == DataIntegrity::Status::CORRUPT;
+            cout << path << ": "
+                 << (status == DataIntegrity::Status::VERIFIED ? "ok" : status == DataIntegrity::Status::CORRUPT ? "CORRUPT"
+                                                                     : status == DataIntegrity::Status::EDITED ? "edited by hand (checksum stale)"
+                                                                                                                 : "no checksum")
+                 << " (" << stamp.size << " bytes)" << endl;
+        }
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cout << "Verified " << bytes << " bytes in " << fixed << setprecision(3) << seconds * 1000 << " ms using "
+         << (Crc32c::hardwareAccelerated() ? "SSE4.2" : "table") << " CRC32C." << endl;
+    return corrupt ? 1 : 0;
+}
+
+// Round-trips every on-disk format through a scratch directory: each store
+// is written by one instance and read back by a fresh one, and must come back
+// unchanged. Returns the process exit code.
+int runSelfTest()
+{
+    char scratch[] = "/tmp/diet-self-test-XXXXXX";
+    if (!::mkdtemp(scratch))
+    {
+        cerr << "Unable to create a scratch directory: " << strerror(errno) << endl;
+        return 1;
+    }
+    const string dir = scratch;
+
+    // The stores report progress on cout and cerr; only the verdicts are shown
+    ostringstream chatter;
+    streambuf *out = cout.rdbuf(), *err = cerr.rdbuf();
+    auto quiet = [&](bool on)
+    {
+        cout.rdbuf(on ? chatter.rdbuf() : out);
+        cerr.rdbuf(on ? chatter.rdbuf() : err);
+    };
+    int failures = 0;
+    auto check = [&](const string &format, const function<string()> &test)
+    {
+        string failure;
+        quiet(true);
+        try
+        {
+            failure = test();
+        }
+        catch (const exception &e)
+        {
+            failure = e.what();
+        }
+        quiet(false);
+        cout << "  " << setw(10) << left << format << (failure.empty() ? "ok" : "FAILED: " + failure) << endl;
+        failures += !failure.empty();
+    };
+    auto exists = [](const string &path)
+    {
+        struct stat st;
+        return ::stat(path.c_str(), &st) == 0;
+    };
+    auto slurp = [](const string &path)
+    {
+        ifstream file(path, ios::binary);
+        return string(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+    };
+
+    // A catalog with nutrients, an untracked nutrient and nested composites
+    json catalog = json::array();
+    for (int i = 0; i < 40; ++i)
+    {
+        json food = {{"name", "Basic " + to_string(i)}, {"type", "basic"}, {"calories", 10.0 + i * 7.5},
+                     {"keywords", {"basic", i % 2 ? "odd" : "even"}}};
+        if (i % 3 == 0)
+            food["nutrients"] = {{"protein", 1.5 * i}, {"sodium", 20.0 + i}, {"zinc", 0.25 * i}};
+        catalog.push_back(food);
+    }
+    for (int i = 0; i < 10; ++i)
+    {
+        json components = {{{"name", "Basic " + to_string(i)}, {"servings", 1.5}},
+                           {{"name", "Basic " + to_string(39 - i)}, {"servings", 0.5}}};
+        if (i > 0)
+            components.push_back({{"name", "Meal " + to_string(i - 1)}, {"servings", 1.0}});
+        catalog.push_back({{"name", "Meal " + to_string(i)}, {"type", "composite"}, {"keywords", {"meal"}},
+                           {"components", components}});
+    }
+    const string catalogText = catalog.dump(4);
+
+    // Every food as saved, plus its listed calories, in listing order
+    auto describe = [](FoodDatabaseManager &db)
+    {
+        string text;
+        db.forEachFood([&](const FoodDatabaseManager::FoodListing &food)
+                       { text += string(food.name) + " " + to_string(food.calories) + "\n"; });
+        for (const string &name : db.listFoodNames())
+            text += db.getFood(name)->toJson().dump() + "\n";
+        return text;
+    };
+    // A fresh database file in its own directory, as saved by hand
+    auto freshDatabase = [&](const string &name)
+    {
+        ::mkdir((dir + "/" + name).c_str(), 0755);
+        string path = dir + "/" + name + "/food_database.json";
+        ofstream(path) << catalogText;
+        return path;
+    };
+
+    cout << "Self-test in " << dir << ":" << endl;
+
+    check("parallel", [&]() -> string
+          {
+        map<string, shared_ptr<Food>> serialBasics, parallelBasics;
+        map<string, PendingComposite> serialPending, parallelPending;
+        if (!FoodCatalogFastParser::parse(catalogText.data(), catalogText.size(), serialBasics, serialPending) ||
+            !ParallelCatalogParser::parse(catalogText.data(), catalogText.size(), 4, parallelBasics, parallelPending))
+            return "catalog not parsed";
+        if (serialBasics.size() != parallelBasics.size() || serialPending.size() != parallelPending.size())
+            return "parsers disagree on the food count";
+        for (const auto &[name, food] : serialBasics)
+        {
+            auto other = parallelBasics.find(name);
+            if (other == parallelBasics.end() || other->second->toJson() != food->toJson())
+                return "parsers disagree on " + name;
+        }
+        map<string, shared_ptr<Food>> basics;
+        map<string, PendingComposite> pending;
+        string trailing = catalogText + " x";
+        if (ParallelCatalogParser::parse(trailing.data(), trailing.size(), 4, basics, pending))
+            return "trailing data after the array accepted";
+        return ""; });
+
+    string expected;
+    check("snapshot", [&]() -> string
+          {
+        string path = freshDatabase("snapshot");
+        FoodDatabaseManager parsed(path);
+        parsed.loadDatabase();
+        expected = describe(parsed);
+        FileStamp source;
+        CatalogSnapshot::View view;
+        if (!FileStamp::of(path, source) || !view.attach(path + ".snap", source))
+            return "no snapshot written for the catalog";
+        FoodDatabaseManager mapped(path);
+        mapped.loadDatabase();
+        return describe(mapped) == expected ? "" : "foods differ after reading the snapshot"; });
+
+    check("journal", [&]() -> string
+          {
+        string path = freshDatabase("journal");
+        {
+            FoodDatabaseManager db(path);
+            db.loadDatabase();
+            db.addFood(make_shared<BasicFood>("Journaled", vector<string>{"new"}, 123.0f));
+            db.updateFoodCalories("Basic 0", 99.0f);
+            expected = describe(db);
+        }
+        if (!exists(path + ".journal"))
+            return "no journal written";
+        FoodDatabaseManager replayed(path);
+        replayed.loadDatabase();
+        return describe(replayed) == expected ? "" : "foods differ after replaying the journal"; });
+
+    check("shards", [&]() -> string
+          {
+        string path = freshDatabase("shards");
+        FoodDatabaseManager plain(path);
+        plain.loadDatabase();
+        expected = describe(plain);
+        {
+            FoodDatabaseManager splitting(path);
+            splitting.setShardCount(4);
+            splitting.loadDatabase();
+        }
+        if (!exists(path + ".shards"))
+            return "no shards written";
+        FoodDatabaseManager sharded(path);
+        sharded.setShardCount(4);
+        sharded.loadDatabase();
+        if (describe(sharded) != expected || sharded.foodCount() != plain.foodCount())
+            return "foods differ after reading the shards";
+        sharded.addFood(make_shared<BasicFood>("Sharded", vector<string>{"new"}, 7.0f));
+        sharded.updateFoodCalories("Basic 1", 1.0f);
+        expected = describe(sharded);
+        if (!sharded.saveDatabase())
+            return "shards not saved";
+        FoodDatabaseManager reread(path);
+        reread.setShardCount(4);
+        reread.loadDatabase();
+        return describe(reread) == expected ? "" : "foods differ after rewriting the shards"; });
+
+    // Diary stores, each fed the same entries: one long past, one recent
+    FoodDatabaseManager foods(freshDatabase("diary"));
+    quiet(true);
+    foods.loadDatabase();
+    quiet(false);
+    int32_t today;
+    DateUtil::toDayNumber(DateUtil::getCurrentDate(), today);
+    const string oldDate = DateUtil::fromDayNumber(today - 400), recentDate = DateUtil::fromDayNumber(today - 40);
+    auto fillDiary = [&](FoodDiary &diary)
+    {
+        diary.addFood(oldDate, "Basic 3", 2.0);
+        diary.addFood(oldDate, "Meal 4", 1.0);
+        diary.addFood(recentDate, "Meal 9", 0.5);
+        diary.saveLogs();
+    };
+    auto sameDiary = [&](const FoodDiary &diary)
+    {
+        return diary.getTotalCaloriesForDate(oldDate) == 2.0 * foods.getFood("Basic 3")->getCalories() + foods.getFood("Meal 4")->getCalories() &&
+               diary.getTotalCaloriesForDate(recentDate) == 0.5 * foods.getFood("Meal 9")->getCalories();
+    };
+
+    check("bin", [&]() -> string
+          {
+        string log = dir + "/diary/food_log.json";
+        {
+            FoodDiary diary(foods, log);
+            fillDiary(diary);
+        }
+        if (!exists(log + ".bin"))
+            return "no diary mirror written";
+        FoodDiary diary(foods, log);
+        if (!sameDiary(diary))
+            return "diary differs after reading its mirror";
+
+        string profilePath = dir + "/diary/user_profile.json";
+        UserProfile profile("tester", Gender::FEMALE, 165.5, 41, CalorieCalculationMethod::HARRIS_BENEDICT);
+        profile.setDailyProfile(oldDate, DailyProfile(61.5, ActivityLevel::VERY_ACTIVE));
+        profile.setDailyProfile(recentDate, DailyProfile(60.0, ActivityLevel::SEDENTARY));
+        RecordFile::Builder builder(UserProfile::recordSizes());
+        profile.toRecords(builder);
+        ofstream(profilePath) << profile.toJson().dump(2);
+        FileStamp source;
+        auto mirror = make_shared<RecordFile>();
+        UserProfile loaded;
+        if (!FileStamp::of(profilePath, source) || !builder.write(profilePath + ".bin", RecordFile::PROFILE, source) ||
+            !mirror->open(profilePath + ".bin", RecordFile::PROFILE, source, UserProfile::recordSizes()) ||
+            !UserProfile::fromRecords(mirror, loaded))
+            return "profile mirror not written or read";
+        return loaded.toJson() == profile.toJson() ? "" : "profile differs after reading its mirror"; });
+
+    check("archive", [&]() -> string
+          {
+        string log = dir + "/archive/food_log.json";
+        ::mkdir((dir + "/archive").c_str(), 0755);
+        {
+            FoodDiary diary(foods, log, true);
+            diary.setArchiveAfterDays(100);
+            diary.loadLogs();
+            fillDiary(diary);
+        }
+        if (!exists(log + ".archive") || slurp(log).find(oldDate) != string::npos)
+            return "old day not moved into the archive";
+        FoodDiary diary(foods, log, true);
+        diary.setArchiveAfterDays(100);
+        diary.loadLogs();
+        return sameDiary(diary) ? "" : "diary differs after reading the archive"; });
+
+    check("months", [&]() -> string
+          {
+        string log = dir + "/months/food_log.json";
+        ::mkdir((dir + "/months").c_str(), 0755);
+        {
+            FoodDiary diary(foods, log, true);
+            diary.setMonthlyPartitions(true);
+            diary.loadLogs();
+            fillDiary(diary);
+        }
+        if (!exists(log + ".months/" + oldDate.substr(0, 7) + ".json") || exists(log))
+            return "diary not split into months";
+        FoodDiary diary(foods, log);
+        return sameDiary(diary) ? "" : "diary differs after reading the months"; });
+
+    // Leaves no trace of the scratch directory
+    function<void(const string &)> removeTree = [&](const string &path)
+    {
+        if (DIR *entries = ::opendir(path.c_str()))
+        {
+            while (dirent *entry = ::readdir(entries))
+            {
+                string name = entry->d_name;
+                if (name != "." && name != "..")
+                    removeTree(path + "/" + name);
+            }
+            ::closedir(entries);
+            ::rmdir(path.c_str());
+        }
+        else
+        {
+            ::remove(path.c_str());
+        }
+    };
+    removeTree(dir);
+
+    cout << (failures ? to_string(failures) + " format(s) FAILED." : "All formats round-trip.") << endl;
+    return failures ? 1 : 0;
+}
+
+// Data-oriented layout of a whole catalog, used only by --bench-eval to
+// measure it against the Food objects, which are what the CLI works with.
+// Foods are rows of parallel arrays indexed by id, tagged with their kind
+// instead of being objects of a class; a composite refers to its flattened
+// leaves by basic food id. So evaluating every food is a few loops over
+// contiguous memory, with no virtual calls, locks or pointer chasing.
+class FoodEvaluationEngine
+{
+public:
+    enum class Kind : uint8_t
+    {
+        BASIC,
+        COMPOSITE
+    };
+
+private:
+    vector<Kind> kinds;
+    vector<float> calories;
+    vector<NutrientVector> nutrients;
+    vector<uint32_t> composites;
+
+    // Leaves of food i are [leafBegin[i], leafBegin[i + 1]); leafRows points
+    // at the nutrient row of each leaf, as the kernel reads rows by pointer
+    vector<uint32_t> leafBegin;
+    vector<uint32_t> leafIds;
+    vector<float> leafServings;
+    vector<const NutrientVector *> leafRows;
+
+    uint32_t add(const Food &food, Kind kind)
+    {
+        uint32_t id = static_cast<uint32_t>(kinds.size());
+        kinds.push_back(kind);
+        calories.push_back(kind == Kind::BASIC ? food.getCalories() : 0.0f);
+        nutrients.push_back(kind == Kind::BASIC ? food.getNutrients() : NutrientVector());
+        if (kind == Kind::COMPOSITE)
+            composites.push_back(id);
+        return id;
+    }
+
+public:
+    // Takes every food of `catalog`, plus basic foods its composites are made
+    // of that it does not list (reference or shard foods, say)
+    explicit FoodEvaluationEngine(const map<string, shared_ptr<Food>> &catalog)
+    {
+        unordered_map<const Food *, uint32_t> idOf;
+        vector<const CompositeFood *> sources;
+        for (const auto &[name, food] : catalog)
+        {
+            auto composite = dynamic_cast<const CompositeFood *>(food.get());
+            idOf[food.get()] = add(*food, composite ? Kind::COMPOSITE : Kind::BASIC);
+            sources.push_back(composite);
+        }
+        for (size_t i = 0, count = sources.size(); i < count; ++i)
+        {
+            if (!sources[i])
+                continue;
+            for (const BasicFood *leaf : sources[i]->getLeafFoods())
+            {
+                if (idOf.emplace(leaf, static_cast<uint32_t>(kinds.size())).second)
+                {
+                    add(*leaf, Kind::BASIC);
+                    sources.push_back(nullptr);
+                }
+            }
+        }
+
+        leafBegin.reserve(kinds.size() + 1);
+        for (const CompositeFood *composite : sources)
+        {
+            leafBegin.push_back(static_cast<uint32_t>(leafIds.size()));
+            if (!composite)
+                continue;
+            for (const BasicFood *leaf : composite->getLeafFoods())
+                leafIds.push_back(idOf[leaf]);
+            const auto &servings = composite->getLeafServings();
+            leafServings.insert(leafServings.end(), servings.begin(), servings.end());
+        }
+        leafBegin.push_back(static_cast<uint32_t>(leafIds.size()));
+
+        leafRows.reserve(leafIds.size());
+        for (uint32_t leaf : leafIds)
+            leafRows.push_back(&nutrients[leaf]);
+    }
+
+    // Rows hold pointers into the engine's own arrays
+    FoodEvaluationEngine(const FoodEvaluationEngine &) = delete;
+    FoodEvaluationEngine &operator=(const FoodEvaluationEngine &) = delete;
+
+    float getCalories(uint32_t id) const { return calories[id]; }
+    const NutrientVector &getNutrients(uint32_t id) const { return nutrients[id]; }
+
+    // Summed leaf by leaf in the order CompositeFood::getCalories uses, so
+    // the totals are the same to the bit
+    void evaluateCalories()
+    {
+        for (uint32_t id : composites)
+        {
+            float total = 0.0f;
+            for (uint32_t k = leafBegin[id]; k < leafBegin[id + 1]; ++k)
+                total += calories[leafIds[k]] * leafServings[k];
+            calories[id] = total;
+        }
+    }
+
+    // One kernel call per composite; run after evaluateCalories
+    void evaluateNutrients()
+    {
+        for (uint32_t id : composites)
+        {
+            NutrientVector total;
+            uint32_t begin = leafBegin[id];
+            NutrientKernels::accumulate(total, leafRows.data() + begin, leafServings.data() + begin, leafBegin[id + 1] - begin);
+            total[NutrientVector::CALORIES] = calories[id];
+            nutrients[id] = total;
+        }
+    }
+};
+
+// Times evaluating every food of a synthetic catalog through the Food
+// objects and through FoodEvaluationEngine, and checks both agree; returns
+// the process exit code
+int benchmarkEvaluation(size_t foodCount)
+{
+    constexpr int ROUNDS = 5;
+    constexpr int LEVELS = 4;
+
+    // Half basic foods, half composites in levels built on the ones below
+    struct Spec
+    {
+        float calories = 0.0f;
+        NutrientVector nutrients;
+        vector<pair<size_t, float>> components;
+    };
+    mt19937 random(42);
+    size_t basicCount = max<size_t>(1, foodCount / 2);
+    size_t compositeCount = foodCount - basicCount;
+    vector<Spec> specs(foodCount);
+    uniform_real_distribution<float> amount(0.0f, 50.0f);
+    for (size_t i = 0; i < basicCount; ++i)
+    {
+        specs[i].calories = uniform_real_distribution<float>(10.0f, 600.0f)(random);
+        for (size_t n = NutrientVector::CALORIES + 1; n < NutrientVector::COUNT; ++n)
+            specs[i].nutrients[n] = random() % 2 ? amount(random) : 0.0f;
+    }
+    for (size_t j = 0; j < compositeCount; ++j)
+    {
+        size_t level = j * LEVELS / compositeCount;
+        size_t below = compositeCount * level / LEVELS; // composites of lower levels
+        size_t parts = 3 + random() % 4;
+        for (size_t c = 0; c < parts; ++c)
+        {
+            size_t component = below && random() % 5 < 2 ? basicCount + random() % below : random() % basicCount;
+            specs[basicCount + j].components.emplace_back(component, 0.25f * (1 + random() % 12));
+        }
+    }
+
+    auto build = [&]()
+    {
+        vector<shared_ptr<Food>> foods(foodCount);
+        for (size_t i = 0; i < foodCount; ++i)
+        {
+            char name[32];
+            snprintf(name, sizeof(name), "food-%08zu", i);
+            if (i < basicCount)
+            {
+                foods[i] = make_shared<BasicFood>(name, vector<string>(), specs[i].calories, specs[i].nutrients);
+                continue;
+            }
+            vector<FoodComponent> components;
+            for (const auto &[component, servings] : specs[i].components)
+                components.emplace_back(foods[component], servings);
+            foods[i] = make_shared<CompositeFood>(name, vector<string>(), components);
+        }
+        map<string, shared_ptr<Food>> catalog;
+        for (auto &food : foods)
+            catalog.emplace(food->getName(), move(food));
+        return catalog;
+    };
+
+    using Clock = chrono::steady_clock;
+    auto elapsed = [](Clock::time_point since)
+    {
+        return chrono::duration<double, milli>(Clock::now() - since).count();
+    };
+    double best[4] = {1e300, 1e300, 1e300, 1e300};
+    size_t leaves = 0;
+    bool match = true;
+    volatile float sink = 0.0f;
+    for (int round = 0; round < ROUNDS; ++round)
+    {
+        // Fresh objects each round, so no composite has cached its calories
+        auto catalog = build();
+        vector<const Food *> foods;
+        foods.reserve(catalog.size());
+        for (const auto &entry : catalog)
+            foods.push_back(entry.second.get());
+
+        auto start = Clock::now();
+        float calories = 0.0f;
+        for (const Food *food : foods)
+            calories += food->getCalories();
+        best[0] = min(best[0], elapsed(start));
+
+        start = Clock::now();
+        vector<NutrientVector> nutrients(foods.size());
+        for (size_t i = 0; i < foods.size(); ++i)
+            nutrients[i] = foods[i]->getNutrients();
+        best[1] = min(best[1], elapsed(start));
+
+        FoodEvaluationEngine engine(catalog);
+        start = Clock::now();
+        engine.evaluateCalories();
+        best[2] = min(best[2], elapsed(start));
+        start = Clock::now();
+        engine.evaluateNutrients();
+        best[3] = min(best[3], elapsed(start));
+
+        // Catalog order is id order
+        leaves = 0;
+        for (uint32_t id = 0; id < foods.size(); ++id)
+        {
+            match = match && engine.getCalories(id) == foods[id]->getCalories() &&
+                    memcmp(engine.getNutrients(id).values, nutrients[id].values, sizeof(nutrients[id].values)) == 0;
+            if (auto composite = dynamic_cast<const CompositeFood *>(foods[id]))
+                leaves += composite->getLeafFoods().size();
+        }
+        sink = sink + calories;
+    }
+
+    cout << "Evaluating " << basicCount << " basic and " << compositeCount << " composite foods ("
+         << fixed << setprecision(1) << (compositeCount ? double(leaves) / compositeCount : 0.0)
+         << " leaves per composite, " << NutrientVector::COUNT << " nutrients, best of " << ROUNDS << "):" << endl;
+    cout << setw(22) << left << "" << setw(14) << right << "Calories" << setw(14) << right << "Nutrients" << endl;
+    cout << setprecision(3);
+    cout << setw(22) << left << "  Food objects" << setw(11) << right << best[0] << " ms"
+         << setw(11) << right << best[1] << " ms" << endl;
+    cout << setw(22) << left << "  Evaluation engine" << setw(11) << right << best[2] << " ms"
+         << setw(11) << right << best[3] << " ms" << endl;
+    cout << setprecision(1);
+    cout << setw(22) << left << "  Speedup" << setw(13) << right << best[0] / max(best[2], 1e-6) << "x"
+         << setw(13) << right << best[1] / max(best[3], 1e-6) << "x" << endl;
+    cout << (match ? "Results match" : "RESULTS DIFFER") << " ("
+         << (NutrientKernels::vectorized() ? "AVX2" : "scalar") << " nutrient kernel)." << endl;
+    return match ? 0 : 1;
+}
+
+int main(int argc, char *argv[])
 {
+    bool shared = false;
+    unsigned long shards = 0;
+    int archiveAfter = 0;
+    bool monthly = false;
+    bool compact = false;
+    for (int i = 1; i < argc; ++i)
+    {
+        string option = argv[i];
+        if (option == "--shared-catalog")
+        {
+            shared = true;
+        }
+        else if (option == "--monthly-logs")
+        {
+            monthly = true;
+        }
+        else if (option == "--compact-json")
+        {
+            compact = true;
+        }
+        else if (option == "--verify")
+        {
+            return verifyDataFiles();
+        }
+        else if (option == "--self-test")
+        {
+            return runSelfTest();
+        }
+        else if (option == "--bench-eval" || option.rfind("--bench-eval=", 0) == 0)
+        {
+            size_t foodCount = 100000;
+            const char *end = option.data() + option.size();
+            if (option.size() > 12)
+            {
+                auto parsed = from_chars(option.data() + 13, end, foodCount);
+                if (parsed.ec != errc() || parsed.ptr != end || foodCount < 2 || foodCount > 10000000)
+                {
+                    cerr << "Invalid food count: " << option.substr(13) << endl;
+                    return 1;
+                }
+            }
+            return benchmarkEvaluation(foodCount);
+        }
+        else if (option.rfind("--shards=", 0) == 0)
+        {
+            const char *end = option.data() + option.size();
+            auto parsed = from_chars(option.data() + 9, end, shards);
+            if (parsed.ec != errc() || parsed.ptr != end || shards == 0 || shards > 65536)
+            {
+                cerr << "Invalid shard count: " << option.substr(9) << endl;
+                return 1;
+            }
+        }
+        else if (option.rfind("--archive-after=", 0) == 0)
+        {
+            const char *end = option.data() + option.size();
+            auto parsed = from_chars(option.data() + 16, end, archiveAfter);
+            if (parsed.ec != errc() || parsed.ptr != end || archiveAfter <= 0)
+            {
+                cerr << "Invalid archive age in days: " << option.substr(16) << endl;
+                return 1;
+            }
+        }
+        else
+        {
+            cerr << "Unknown option: " << option << endl;
+            cerr << "Usage: " << argv[0] << " [--shared-catalog | --shards=N] [--archive-after=DAYS | --monthly-logs] [--compact-json] | --verify | --self-test | --bench-eval[=FOODS]" << endl;
+            return 1;
+        }
+    }
+    if (shared && shards)
+    {
+        cerr << "--shared-catalog and --shards cannot be combined." << endl;
+        return 1;
+    }
+    if (archiveAfter && monthly)
+    {
+        cerr << "--archive-after and --monthly-logs cannot be combined." << endl;
+        return 1;
+    }
+
+    // Constructed only once the options are valid: its destructor saves the data files
     DietAssistantCLI dietAssistant;
+    if (shared)
+        dietAssistant.useSharedCatalog();
+    if (shards)
+        dietAssistant.useShardedCatalog(static_cast<uint32_t>(shards));
+    if (archiveAfter)
+        dietAssistant.archiveDiaryAfter(archiveAfter);
+    if (monthly)
+        dietAssistant.partitionDiaryByMonth();
+    if (compact)
+        dietAssistant.writeCompactJson();
     dietAssistant.start();
     return 0;
-}
\ No newline at end of file
+}